@@ -1,140 +1,3629 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <sys/ioctl.h>
 #include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// everything one render needs (stb_image's buffers included) comes out of an arena, which is a few big chunks that
+// allocations just get bumped along. freeing the newest allocation hands its space straight back, anything older is
+// kept for a later allocation that fits and the rest goes all at once when the arena is reset. after a reset it's
+// down to a single chunk big enough for the most it ever held, so doing the same kind of render again never mallocs
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK_BYTES (1 << 20)
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+typedef struct arenaChunk {
+	struct arenaChunk* next;
+	struct arena* owner;
+	// newest allocation still in the chunk, each one points at the one before it
+	struct arenaHeader* top;
+	size_t size;
+	size_t used;
+} arenaChunk;
+
+// sits right before every allocation, including ones that didn't come from an arena so they can all be freed the same way
+typedef struct arenaHeader {
+	// NULL when it came straight from malloc
+	arenaChunk* chunk;
+	struct arenaHeader* below;
+	size_t size;
+	bool freed;
+} arenaHeader;
+
+#define ARENA_CHUNK_HEADER ARENA_ROUND(sizeof(arenaChunk))
+#define ARENA_HEADER ARENA_ROUND(sizeof(arenaHeader))
+
+typedef struct arena {
+	// pool threads allocate from whatever arena the thread that handed them the job was using
+	pthread_mutex_t lock;
+	// newest first, only the newest one gets bumped along
+	arenaChunk* chunks;
+	// bytes handed out of the chunks including the headers and anything freed that hasn't been given back yet
+	size_t used;
+	size_t peak;
+} arena;
+
+// allocations go to the heap when a thread isn't using an arena
+static _Thread_local arena* currentArena = NULL;
+
+bool initArena(arena* a) {
+	memset(a, 0, sizeof(*a));
+	return pthread_mutex_init(&a->lock, NULL) == 0;
+}
+
+void freeArena(arena* a) {
+	while(a->chunks) {
+		arenaChunk* next = a->chunks->next;
+		free(a->chunks);
+		a->chunks = next;
+	}
+	pthread_mutex_destroy(&a->lock);
+}
+
+// throws away everything allocated from the arena, nothing from it can still be in use
+void resetArena(arena* a) {
+	pthread_mutex_lock(&a->lock);
+	arenaChunk* chunk = a->chunks;
+	if(chunk && chunk->next) {
+		// ended up spread over more than one chunk, next time it all fits in one
+		while(a->chunks) {
+			arenaChunk* next = a->chunks->next;
+			free(a->chunks);
+			a->chunks = next;
+		}
+		chunk = malloc(ARENA_CHUNK_HEADER + a->peak);
+		if(chunk) {
+			chunk->next = NULL;
+			chunk->owner = a;
+			chunk->size = a->peak;
+		}
+		a->chunks = chunk;
+	}
+	if(chunk) {
+		chunk->top = NULL;
+		chunk->used = 0;
+	}
+	a->used = 0;
+	pthread_mutex_unlock(&a->lock);
+}
+
+// returns the arena the thread was using before so it can be put back
+arena* useArena(arena* a) {
+	arena* previous = currentArena;
+	currentArena = a;
+	return previous;
+}
+
+static void arenaPop(arenaChunk* chunk) {
+	while(chunk->top && chunk->top->freed) {
+		size_t offset = (char*)chunk->top - ((char*)chunk + ARENA_CHUNK_HEADER);
+		chunk->owner->used -= chunk->used - offset;
+		chunk->used = offset;
+		chunk->top = chunk->top->below;
+	}
+}
+
+// has to be called with the lock held
+static arenaHeader* arenaTake(arena* a, size_t size) {
+	// the smallest freed allocation it fits in, so a big one doesn't get used up by something tiny
+	arenaHeader* best = NULL;
+	for(arenaChunk* chunk = a->chunks; chunk; chunk = chunk->next) {
+		for(arenaHeader* header = chunk->top; header; header = header->below) {
+			if(header->freed && header->size >= size && (!best || header->size < best->size)) {
+				best = header;
+			}
+		}
+	}
+	if(best) {
+		best->freed = false;
+		return best;
+	}
+	
+	arenaChunk* chunk = a->chunks;
+	if(!chunk || chunk->used + ARENA_HEADER + size > chunk->size) {
+		size_t chunkSize = ARENA_HEADER + size > ARENA_CHUNK_BYTES ? ARENA_HEADER + size : ARENA_CHUNK_BYTES;
+		chunk = malloc(ARENA_CHUNK_HEADER + chunkSize);
+		if(!chunk) {
+			return NULL;
+		}
+		chunk->next = a->chunks;
+		chunk->owner = a;
+		chunk->top = NULL;
+		chunk->size = chunkSize;
+		chunk->used = 0;
+		a->chunks = chunk;
+	}
+	arenaHeader* header = (arenaHeader*)((char*)chunk + ARENA_CHUNK_HEADER + chunk->used);
+	header->chunk = chunk;
+	header->below = chunk->top;
+	header->size = size;
+	header->freed = false;
+	chunk->top = header;
+	chunk->used += ARENA_HEADER + size;
+	a->used += ARENA_HEADER + size;
+	if(a->used > a->peak) {
+		a->peak = a->used;
+	}
+	return header;
+}
+
+void* arenaMalloc(size_t size) {
+	size = ARENA_ROUND(size);
+	arena* a = currentArena;
+	arenaHeader* header;
+	if(a) {
+		pthread_mutex_lock(&a->lock);
+		header = arenaTake(a, size);
+		pthread_mutex_unlock(&a->lock);
+	} else {
+		header = malloc(ARENA_HEADER + size);
+		if(header) {
+			header->chunk = NULL;
+			header->size = size;
+		}
+	}
+	return header ? (char*)header + ARENA_HEADER : NULL;
+}
+
+void* arenaCalloc(size_t count, size_t size) {
+	if(size && count > SIZE_MAX / size) {
+		return NULL;
+	}
+	void* p = arenaMalloc(count * size);
+	if(p) {
+		memset(p, 0, count * size);
+	}
+	return p;
+}
+
+void arenaFree(void* p) {
+	if(!p) {
+		return;
+	}
+	arenaHeader* header = (arenaHeader*)((char*)p - ARENA_HEADER);
+	arenaChunk* chunk = header->chunk;
+	if(!chunk) {
+		free(header);
+		return;
+	}
+	pthread_mutex_lock(&chunk->owner->lock);
+	header->freed = true;
+	arenaPop(chunk);
+	pthread_mutex_unlock(&chunk->owner->lock);
+}
+
+void* arenaRealloc(void* p, size_t size) {
+	if(!p) {
+		return arenaMalloc(size);
+	}
+	size = ARENA_ROUND(size);
+	arenaHeader* header = (arenaHeader*)((char*)p - ARENA_HEADER);
+	arenaChunk* chunk = header->chunk;
+	if(!chunk) {
+		arenaHeader* newHeader = realloc(header, ARENA_HEADER + size);
+		if(!newHeader) {
+			return NULL;
+		}
+		newHeader->size = size;
+		return (char*)newHeader + ARENA_HEADER;
+	}
+	if(size <= header->size) {
+		return p;
+	}
+	arena* a = chunk->owner;
+	pthread_mutex_lock(&a->lock);
+	// the newest allocation can just grow into the rest of the chunk, which is what happens to anything getting appended to
+	if(header == chunk->top && chunk->used - header->size + size <= chunk->size) {
+		chunk->used += size - header->size;
+		a->used += size - header->size;
+		if(a->used > a->peak) {
+			a->peak = a->used;
+		}
+		header->size = size;
+		pthread_mutex_unlock(&a->lock);
+		return p;
+	}
+	arenaHeader* newHeader = arenaTake(a, size);
+	if(newHeader) {
+		memcpy((char*)newHeader + ARENA_HEADER, p, header->size);
+		header->freed = true;
+		arenaPop(chunk);
+	}
+	pthread_mutex_unlock(&a->lock);
+	return newHeader ? (char*)newHeader + ARENA_HEADER : NULL;
+}
+
+#define STBI_MALLOC(size) arenaMalloc(size)
+#define STBI_REALLOC(p, size) arenaRealloc(p, size)
+#define STBI_FREE(p) arenaFree(p)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-#define UNUSED __attribute((unused))
+#define UNUSED __attribute((unused))
+
+// gallery mode draws a bunch of images at once from different threads and just shows which ones failed,
+// messages printed in the middle of that would end up all over the tiles
+static bool quietErrors = false;
+
+static void printError(const char* format, ...) {
+	if(quietErrors) {
+		return;
+	}
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+}
+
+// same byte order stb_image gives back so a row of these can be read as 32 bit words r | g << 8 | b << 16 | a << 24
+typedef struct {
+	uint8_t r, g, b, a;
+} terminalColor;
+_Static_assert(sizeof(terminalColor) == 4, "the simd kernels expect pixels to be packed into 32 bits");
+
+// the whole frame gets built up in here and then written out with a single write() call
+// instead of doing a bunch of printf calls per cell, which was really slow over ssh
+typedef struct {
+	char* data;
+	size_t size;
+	size_t capacity;
+} frameBuffer;
+
+// worst case for one cell, "\033[65535;65535H" plus "\033[38;2;255;255;255m\033[48;2;255;255;255m" and a 4 byte glyph
+// (octants are past U+FFFF), 56 bytes all together
+#define FRAME_MAX_CELL_BYTES 64
+
+bool frameInit(frameBuffer* frame, size_t capacity) {
+	frame->data = arenaMalloc(capacity);
+	frame->size = 0;
+	frame->capacity = capacity;
+	return frame->data != NULL;
+}
+
+void frameFree(frameBuffer* frame) {
+	arenaFree(frame->data);
+	frame->data = NULL;
+	frame->size = 0;
+	frame->capacity = 0;
+}
+
+// should only really need to grow if the initial size guess was wrong
+bool frameReserve(frameBuffer* frame, size_t bytes) {
+	if(frame->size + bytes <= frame->capacity) {
+		return true;
+	}
+	size_t newCapacity = frame->capacity * 2;
+	if(newCapacity < frame->size + bytes) {
+		newCapacity = frame->size + bytes;
+	}
+	char* newData = arenaRealloc(frame->data, newCapacity);
+	if(!newData) {
+		return false;
+	}
+	frame->data = newData;
+	frame->capacity = newCapacity;
+	return true;
+}
+
+// these don't check the capacity, call frameReserve before using them
+static inline void frameAppendBytes(frameBuffer* frame, const char* bytes, size_t length) {
+	memcpy(frame->data + frame->size, bytes, length);
+	frame->size += length;
+}
+
+#define frameAppendLiteral(frame, str) frameAppendBytes(frame, str, sizeof(str) - 1)
+
+static inline void frameAppendUInt(frameBuffer* frame, unsigned int n) {
+	char digits[10];
+	unsigned int count = 0;
+	do {
+		digits[count++] = '0' + (n % 10);
+		n /= 10;
+	} while(n > 0);
+	// digits come out backwards
+	while(count > 0) {
+		frame->data[frame->size++] = digits[--count];
+	}
+}
+
+static bool writeAll(int fd, const char* data, size_t size) {
+	size_t written = 0;
+	while(written < size) {
+		ssize_t result = write(fd, data + written, size - written);
+		if(result < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		written += result;
+	}
+	return true;
+}
+
+bool frameFlush(frameBuffer* frame, int fd) {
+	if(!writeAll(fd, frame->data, frame->size)) {
+		return false;
+	}
+	frame->size = 0;
+	return true;
+}
+
+// the whole file gets mapped into memory and stb_image reads it in place, going through stdio meant every byte got copied
+// into stdio's buffer and then stb's before it was even looked at. pipes and such can't be mapped so they just get read in,
+// straight into the buffer stb_image decodes from
+typedef struct {
+	const char* path;
+	const unsigned char* data;
+	size_t size;
+	bool mapped;
+	// path is somewhere it can be opened again, not just a name for stdin
+	bool named;
+} inputFile;
+
+void closeInputFile(inputFile* input);
+
+static bool readInputFile(inputFile* input, int fd) {
+	size_t capacity = 65536;
+	unsigned char* data = malloc(capacity);
+	size_t size = 0;
+	while(data) {
+		if(size == capacity) {
+			capacity *= 2;
+			unsigned char* newData = realloc(data, capacity);
+			if(!newData) {
+				break;
+			}
+			data = newData;
+		}
+		ssize_t result = read(fd, data + size, capacity - size);
+		if(result < 0 && errno == EINTR) {
+			continue;
+		}
+		if(result <= 0) {
+			if(result == 0) {
+				input->data = data;
+				input->size = size;
+				return true;
+			}
+			break;
+		}
+		size += result;
+	}
+	free(data);
+	return false;
+}
+
+// a path of - reads from stdin, which still gets mapped if it's redirected from a file
+bool openInputFile(inputFile* input, const char* path) {
+	bool isStdin = strcmp(path, "-") == 0;
+	input->path = isStdin ? "stdin" : path;
+	input->data = NULL;
+	input->size = 0;
+	input->mapped = false;
+	input->named = !isStdin;
+	
+	int fd = isStdin ? STDIN_FILENO : open(path, O_RDONLY);
+	if(fd < 0) {
+		printError("Couldn't open \"%s\": %s\n", path, strerror(errno));
+		return false;
+	}
+	
+	bool succeeded;
+	struct stat info;
+	if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+		void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		succeeded = data != MAP_FAILED;
+		if(succeeded) {
+			// it gets read front to back pretty much once, so the kernel can read ahead as far as it wants
+			madvise(data, info.st_size, MADV_SEQUENTIAL);
+			madvise(data, info.st_size, MADV_WILLNEED);
+			input->data = data;
+			input->size = info.st_size;
+			input->mapped = true;
+		}
+	} else {
+		succeeded = readInputFile(input, fd);
+	}
+	if(!isStdin) {
+		close(fd);
+	}
+	
+	if(!succeeded) {
+		printError("Couldn't read \"%s\": %s\n", input->path, strerror(errno));
+		return false;
+	}
+	// stb_image takes the length as an int
+	if(input->size > INT_MAX) {
+		printError("\"%s\" is too big\n", input->path);
+		closeInputFile(input);
+		return false;
+	}
+	return true;
+}
+
+void closeInputFile(inputFile* input) {
+	if(input->mapped) {
+		munmap((void*)input->data, input->size);
+	} else {
+		free((void*)input->data);
+	}
+	input->data = NULL;
+	input->size = 0;
+	input->mapped = false;
+}
+
+// finished frames get saved under $XDG_CACHE_HOME/imgview so drawing the same file at the same size again is just
+// mapping the saved escape codes and writing them out. files are named by a hash of everything that affects the output,
+// and the same key is stored at the start of the file so a hash collision just counts as a miss
+#define RENDER_CACHE_VERSION 4
+#define RENDER_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+typedef struct {
+	uint32_t version;
+	// the source file, going by these instead of hashing the contents means a hit doesn't have to read the image at all
+	uint64_t device, inode, size;
+	int64_t mtimeSeconds, mtimeNanoseconds;
+	// render options, w and h are in pixels with a graphics protocol. the frame also places the image on the grid of
+	// cells, so columns and rows are kept too for when the font size changes but the window's pixel size doesn't
+	uint32_t w, h;
+	uint32_t columns, rows;
+	uint32_t colorMode, kernel, blocks, graphics;
+} renderCacheKey;
+
+typedef struct {
+	char dir[PATH_MAX];
+	char path[PATH_MAX];
+	renderCacheKey key;
+} renderCache;
+
+static bool renderCacheDir(char* dir, size_t size) {
+	char base[PATH_MAX];
+	const char* xdgCache = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	int length;
+	if(xdgCache && xdgCache[0] == '/') {
+		length = snprintf(base, sizeof(base), "%s", xdgCache);
+	} else if(home && home[0]) {
+		length = snprintf(base, sizeof(base), "%s/.cache", home);
+	} else {
+		return false;
+	}
+	if(length < 0 || (size_t)length >= sizeof(base)) {
+		return false;
+	}
+	// the base directory might not exist yet either, if it really can't be made the next mkdir fails anyway
+	mkdir(base, 0700);
+	length = snprintf(dir, size, "%s/imgview", base);
+	if(length < 0 || (size_t)length >= size) {
+		return false;
+	}
+	return mkdir(dir, 0700) == 0 || errno == EEXIST;
+}
+
+// returns false if the image can't be cached (pipes and such). - is stdin, not whatever file has that name
+bool initRenderCache(renderCache* cache, const char* imagePath, unsigned int w, unsigned int h, unsigned int columns, unsigned int rows, unsigned int colorMode, unsigned int kernel, unsigned int blocks, unsigned int graphics) {
+	struct stat info;
+	if(strcmp(imagePath, "-") == 0 || stat(imagePath, &info) != 0 || !S_ISREG(info.st_mode)) {
+		return false;
+	}
+	// zeroed first so the padding always hashes the same
+	memset(&cache->key, 0, sizeof(cache->key));
+	cache->key.version = RENDER_CACHE_VERSION;
+	cache->key.device = info.st_dev;
+	cache->key.inode = info.st_ino;
+	cache->key.size = info.st_size;
+	cache->key.mtimeSeconds = info.st_mtim.tv_sec;
+	cache->key.mtimeNanoseconds = info.st_mtim.tv_nsec;
+	cache->key.w = w;
+	cache->key.h = h;
+	cache->key.columns = columns;
+	cache->key.rows = rows;
+	cache->key.colorMode = colorMode;
+	cache->key.kernel = kernel;
+	cache->key.blocks = blocks;
+	cache->key.graphics = graphics;
+	
+	if(!renderCacheDir(cache->dir, sizeof(cache->dir))) {
+		return false;
+	}
+	
+	// fnv-1a
+	uint64_t hash = 0xcbf29ce484222325ull;
+	const unsigned char* bytes = (const unsigned char*)&cache->key;
+	for(size_t i = 0; i < sizeof(cache->key); ++i) {
+		hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+	}
+	int length = snprintf(cache->path, sizeof(cache->path), "%s/%016llx", cache->dir, (unsigned long long)hash);
+	return length > 0 && (size_t)length < sizeof(cache->path);
+}
+
+// writes the saved frame out if there is one
+bool renderCacheServe(const renderCache* cache, int fd) {
+	int cacheFd = open(cache->path, O_RDONLY);
+	if(cacheFd < 0) {
+		return false;
+	}
+	bool served = false;
+	struct stat info;
+	if(fstat(cacheFd, &info) == 0 && (size_t)info.st_size > sizeof(renderCacheKey)) {
+		const char* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, cacheFd, 0);
+		if(data != MAP_FAILED) {
+			if(memcmp(data, &cache->key, sizeof(renderCacheKey)) == 0) {
+				served = writeAll(fd, data + sizeof(renderCacheKey), info.st_size - sizeof(renderCacheKey));
+				// the modification time doubles as the last time it was used for eviction
+				futimens(cacheFd, NULL);
+			}
+			munmap((void*)data, info.st_size);
+		}
+	}
+	close(cacheFd);
+	return served;
+}
+
+typedef struct {
+	char name[NAME_MAX + 1];
+	off_t size;
+	struct timespec used;
+} renderCacheEntry;
+
+static int compareCacheEntries(const void* a, const void* b) {
+	const struct timespec* usedA = &((const renderCacheEntry*)a)->used;
+	const struct timespec* usedB = &((const renderCacheEntry*)b)->used;
+	if(usedA->tv_sec != usedB->tv_sec) {
+		return usedA->tv_sec < usedB->tv_sec ? -1 : 1;
+	}
+	return (usedA->tv_nsec > usedB->tv_nsec) - (usedA->tv_nsec < usedB->tv_nsec);
+}
+
+// throws away the least recently used frames until the whole thing fits under RENDER_CACHE_MAX_BYTES
+static void evictRenderCache(const renderCache* cache) {
+	DIR* dir = opendir(cache->dir);
+	if(!dir) {
+		return;
+	}
+	renderCacheEntry* entries = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	off_t total = 0;
+	struct dirent* dirEntry;
+	while((dirEntry = readdir(dir))) {
+		struct stat info;
+		if(fstatat(dirfd(dir), dirEntry->d_name, &info, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(info.st_mode)) {
+			continue;
+		}
+		if(count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			renderCacheEntry* newEntries = realloc(entries, sizeof(renderCacheEntry) * capacity);
+			if(!newEntries) {
+				break;
+			}
+			entries = newEntries;
+		}
+		strcpy(entries[count].name, dirEntry->d_name);
+		entries[count].size = info.st_size;
+		entries[count].used = info.st_mtim;
+		total += info.st_size;
+		++count;
+	}
+	
+	if(total > RENDER_CACHE_MAX_BYTES) {
+		qsort(entries, count, sizeof(renderCacheEntry), compareCacheEntries);
+		for(size_t i = 0; i < count && total > RENDER_CACHE_MAX_BYTES; ++i) {
+			if(unlinkat(dirfd(dir), entries[i].name, 0) == 0) {
+				total -= entries[i].size;
+			}
+		}
+	}
+	free(entries);
+	closedir(dir);
+}
+
+// failing to save isn't a problem, it'll just get rendered again next time
+void renderCacheStore(const renderCache* cache, const frameBuffer* frame) {
+	// written to a temporary file and renamed over so nothing ever sees half a frame
+	char tempPath[PATH_MAX];
+	if(snprintf(tempPath, sizeof(tempPath), "%s.%ld.tmp", cache->path, (long)getpid()) >= (int)sizeof(tempPath)) {
+		return;
+	}
+	int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if(fd < 0) {
+		return;
+	}
+	bool written = writeAll(fd, (const char*)&cache->key, sizeof(renderCacheKey)) && writeAll(fd, frame->data, frame->size);
+	close(fd);
+	if(!written || rename(tempPath, cache->path) != 0) {
+		unlink(tempPath);
+		return;
+	}
+	evictRenderCache(cache);
+}
+
+// a fixed set of threads that get reused for every parallel step, starting new ones for each stripe of rows was too slow
+// the thread calling workerPoolRun also does jobs so a pool with no extra threads just runs everything in order
+typedef void (*workerJobFunc)(void* ctx, unsigned int index);
+
+typedef struct {
+	pthread_t* threads;
+	unsigned int threadCount;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	
+	workerJobFunc job;
+	void* ctx;
+	unsigned int jobCount;
+	unsigned int nextJob;
+	unsigned int finishedJobs;
+	// gets bumped every time there's new work so sleeping threads know to wake up
+	unsigned int generation;
+	bool quitting;
+	// whatever the jobs allocate comes out of the same arena as the thread that handed them out
+	arena* arena;
+} workerPool;
+
+// has to be called with the lock held, it gets let go while each job actually runs
+static void workerPoolDoJobs(workerPool* pool) {
+	workerJobFunc job = pool->job;
+	void* ctx = pool->ctx;
+	currentArena = pool->arena;
+	while(pool->nextJob < pool->jobCount) {
+		unsigned int index = pool->nextJob++;
+		pthread_mutex_unlock(&pool->lock);
+		job(ctx, index);
+		pthread_mutex_lock(&pool->lock);
+		if(++pool->finishedJobs == pool->jobCount) {
+			pthread_cond_broadcast(&pool->done);
+		}
+	}
+}
+
+static void* workerPoolThread(void* arg) {
+	workerPool* pool = arg;
+	unsigned int seenGeneration = 0;
+	pthread_mutex_lock(&pool->lock);
+	while(true) {
+		while(!pool->quitting && pool->generation == seenGeneration) {
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		}
+		if(pool->quitting) {
+			break;
+		}
+		seenGeneration = pool->generation;
+		workerPoolDoJobs(pool);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+// threads is the total including the calling thread
+bool initWorkerPool(workerPool* pool, unsigned int threads) {
+	memset(pool, 0, sizeof(*pool));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	if(threads <= 1) {
+		return true;
+	}
+	pool->threads = malloc(sizeof(pthread_t) * (threads - 1));
+	if(!pool->threads) {
+		return false;
+	}
+	for(unsigned int i = 0; i < threads - 1; ++i) {
+		if(pthread_create(&pool->threads[i], NULL, workerPoolThread, pool) != 0) {
+			// just go with however many did get started
+			break;
+		}
+		++pool->threadCount;
+	}
+	return true;
+}
+
+void freeWorkerPool(workerPool* pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->quitting = true;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+	for(unsigned int i = 0; i < pool->threadCount; ++i) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	free(pool->threads);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->wake);
+	pthread_cond_destroy(&pool->done);
+}
+
+// runs job(ctx, 0) through job(ctx, jobCount - 1) spread over the pool and waits for all of them to finish
+void workerPoolRun(workerPool* pool, workerJobFunc job, void* ctx, unsigned int jobCount) {
+	if(pool->threadCount == 0 || jobCount <= 1) {
+		for(unsigned int i = 0; i < jobCount; ++i) {
+			job(ctx, i);
+		}
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->job = job;
+	pool->ctx = ctx;
+	pool->jobCount = jobCount;
+	pool->nextJob = 0;
+	pool->finishedJobs = 0;
+	pool->arena = currentArena;
+	++pool->generation;
+	pthread_cond_broadcast(&pool->wake);
+	workerPoolDoJobs(pool);
+	while(pool->finishedJobs < pool->jobCount) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+// how many jobs to split count things into so every thread gets a few and the uneven ones at the end even out
+static unsigned int workerPoolBandCount(const workerPool* pool, unsigned int count) {
+	unsigned int bands = (pool->threadCount + 1) * 4;
+	return bands < count ? bands : count;
+}
+
+// lets the jpeg decoder hand restart intervals to the pool without knowing anything about it
+static void runDecodeJobs(void* pool, stbi_job* job, void* ctx, unsigned int count) {
+	workerPoolRun(pool, job, ctx, count);
+}
+
+typedef enum {
+	RESAMPLE_NEAREST,
+	RESAMPLE_BOX,
+	RESAMPLE_BILINEAR,
+	RESAMPLE_LANCZOS,
+} resampleKernelEnum;
+
+// weights are fixed point so the inner loops are just integer multiply-adds
+#define RESAMPLE_WEIGHT_BITS 14
+// fractional bits kept in between the horizontal and vertical passes, has to be small enough that the
+// vertical sums fit in an int32 (255 << 6 << 14 is still under 2^31 even with lanczos overshooting a bit)
+#define RESAMPLE_MID_BITS 6
+
+// which source pixels go into one output pixel and how much each one counts
+typedef struct {
+	unsigned int start;
+	unsigned int count;
+	int32_t* weights;
+} resampleSpan;
+
+typedef struct {
+	resampleSpan* spans;
+	int32_t* weights;
+} resampleAxis;
+
+static double resampleKernelRadius(resampleKernelEnum kernel) {
+	switch(kernel) {
+		case RESAMPLE_BOX:      return 0.5;
+		case RESAMPLE_BILINEAR: return 1.0;
+		case RESAMPLE_LANCZOS:  return 3.0;
+		default:                return 0.0;
+	}
+}
+
+static double resampleKernelWeight(resampleKernelEnum kernel, double x) {
+	x = fabs(x);
+	switch(kernel) {
+		case RESAMPLE_BILINEAR:
+			return x < 1.0 ? 1.0 - x : 0.0;
+		case RESAMPLE_LANCZOS:
+			if(x < 1e-8) {
+				return 1.0;
+			}
+			if(x >= 3.0) {
+				return 0.0;
+			}
+			return 3.0 * sin(M_PI * x) * sin(M_PI * x / 3.0) / (M_PI * M_PI * x * x);
+		default:
+			return 0.0;
+	}
+}
+
+// the float math only happens once per output row/column here, everything after this is integers
+bool initResampleAxis(resampleAxis* axis, resampleKernelEnum kernel, unsigned int srcSize, unsigned int dstSize) {
+	double scale = srcSize / (double)dstSize;
+	// when shrinking the kernel gets stretched out to cover every source pixel
+	double filterScale = scale > 1.0 ? scale : 1.0;
+	double support = resampleKernelRadius(kernel) * filterScale;
+	unsigned int maxTaps = kernel == RESAMPLE_NEAREST ? 1 : (unsigned int)ceil(support * 2) + 2;
+	
+	axis->spans = arenaMalloc(sizeof(resampleSpan) * dstSize);
+	axis->weights = arenaMalloc(sizeof(int32_t) * dstSize * maxTaps);
+	double* taps = arenaMalloc(sizeof(double) * maxTaps);
+	if(!axis->spans || !axis->weights || !taps) {
+		arenaFree(taps);
+		return false;
+	}
+	
+	for(unsigned int i = 0; i < dstSize; ++i) {
+		resampleSpan* span = &axis->spans[i];
+		span->weights = &axis->weights[i * maxTaps];
+		
+		if(kernel == RESAMPLE_NEAREST) {
+			span->start = (uint64_t)i * srcSize / dstSize;
+			span->count = 1;
+			span->weights[0] = 1 << RESAMPLE_WEIGHT_BITS;
+			continue;
+		}
+		
+		double center = (i + 0.5) * scale;
+		int first = (int)floor(center - support);
+		int last = (int)ceil(center + support);
+		if(first < 0) {
+			first = 0;
+		}
+		if(last > (int)srcSize) {
+			last = srcSize;
+		}
+		
+		double total = 0.0;
+		unsigned int count = 0;
+		for(int j = first; j < last && count < maxTaps; ++j) {
+			double weight;
+			if(kernel == RESAMPLE_BOX) {
+				// how much of the source pixel is covered by this output pixel
+				double low = fmax(j, center - support);
+				double high = fmin(j + 1, center + support);
+				weight = high > low ? high - low : 0.0;
+			} else {
+				weight = resampleKernelWeight(kernel, (j + 0.5 - center) / filterScale);
+			}
+			taps[count++] = weight;
+			total += weight;
+		}
+		if(total == 0.0) {
+			// can happen with tiny upscales on box, just fall back to the closest pixel
+			unsigned int closest = center < srcSize ? (unsigned int)center : srcSize - 1;
+			span->start = closest;
+			span->count = 1;
+			span->weights[0] = 1 << RESAMPLE_WEIGHT_BITS;
+			continue;
+		}
+		
+		// make the integer weights add up to exactly 1 so flat areas stay flat
+		int32_t sum = 0;
+		unsigned int biggest = 0;
+		for(unsigned int k = 0; k < count; ++k) {
+			span->weights[k] = (int32_t)lround(taps[k] / total * (1 << RESAMPLE_WEIGHT_BITS));
+			sum += span->weights[k];
+			if(span->weights[k] > span->weights[biggest]) {
+				biggest = k;
+			}
+		}
+		span->weights[biggest] += (1 << RESAMPLE_WEIGHT_BITS) - sum;
+		span->start = first;
+		span->count = count;
+	}
+	
+	arenaFree(taps);
+	return true;
+}
+
+void freeResampleAxis(resampleAxis* axis) {
+	arenaFree(axis->spans);
+	arenaFree(axis->weights);
+	axis->spans = NULL;
+	axis->weights = NULL;
+}
+
+// the per pixel loops get a vectorized version where the cpu has one, initKernels picks which one gets used
+// the scalar versions are always there as a fallback and for the leftover pixels at the end of a row
+#define RESAMPLE_SHRINK_SHIFT (RESAMPLE_WEIGHT_BITS - RESAMPLE_MID_BITS)
+
+typedef void (*shrinkRowFunc)(int32_t* out, const unsigned char* row, const resampleSpan* spans, unsigned int w);
+typedef void (*accumulateRowFunc)(int32_t* acc, const int32_t* row, int32_t weight, unsigned int count);
+
+// horizontal pass, one rgba source row down to w output pixels
+static void shrinkRowScalar(int32_t* out, const unsigned char* row, const resampleSpan* spans, unsigned int w) {
+	for(unsigned int x = 0; x < w; ++x) {
+		const unsigned char* src = &row[spans[x].start * 4];
+		const int32_t* weights = spans[x].weights;
+		int32_t sum[4] = {0, 0, 0, 0};
+		for(unsigned int k = 0; k < spans[x].count; ++k) {
+			for(unsigned int c = 0; c < 4; ++c) {
+				sum[c] += src[k*4 + c] * weights[k];
+			}
+		}
+		for(unsigned int c = 0; c < 4; ++c) {
+			out[x*4 + c] = (sum[c] + (1 << (RESAMPLE_SHRINK_SHIFT - 1))) >> RESAMPLE_SHRINK_SHIFT;
+		}
+	}
+}
+
+// vertical pass, adds one shrunk row into an output row's running sums
+static void accumulateRowScalar(int32_t* acc, const int32_t* row, int32_t weight, unsigned int count) {
+	for(unsigned int i = 0; i < count; ++i) {
+		acc[i] += row[i] * weight;
+	}
+}
+
+#if defined(__SSE2__)
+// sse2 doesn't have a 32 bit multiply that keeps the low half so it has to be done as two 64 bit ones
+static inline __m128i mulloSSE2(__m128i a, __m128i b) {
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+// weights always fit in 16 bits (they only go a little over 1 << RESAMPLE_WEIGHT_BITS with lanczos) so two taps
+// can be done with one madd by interleaving them as r0 r1 g0 g1 b0 b1 a0 a1
+static void shrinkRowSSE2(int32_t* out, const unsigned char* row, const resampleSpan* spans, unsigned int w) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(1 << (RESAMPLE_SHRINK_SHIFT - 1));
+	for(unsigned int x = 0; x < w; ++x) {
+		const unsigned char* src = &row[spans[x].start * 4];
+		const int32_t* weights = spans[x].weights;
+		unsigned int count = spans[x].count;
+		__m128i sum = zero;
+		unsigned int k = 0;
+		for(; k + 1 < count; k += 2) {
+			__m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)&src[k*4]), zero);
+			pixels = _mm_unpacklo_epi16(pixels, _mm_srli_si128(pixels, 8));
+			__m128i pair = _mm_set1_epi32(((uint32_t)weights[k+1] << 16) | ((uint32_t)weights[k] & 0xffff));
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(pixels, pair));
+		}
+		if(k < count) {
+			int32_t last;
+			memcpy(&last, &src[k*4], 4);
+			__m128i pixel = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(last), zero), zero);
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(pixel, _mm_set1_epi32((uint32_t)weights[k] & 0xffff)));
+		}
+		_mm_storeu_si128((__m128i*)&out[x*4], _mm_srai_epi32(_mm_add_epi32(sum, round), RESAMPLE_SHRINK_SHIFT));
+	}
+}
+
+static void accumulateRowSSE2(int32_t* acc, const int32_t* row, int32_t weight, unsigned int count) {
+	const __m128i weights = _mm_set1_epi32(weight);
+	unsigned int i = 0;
+	for(; i + 4 <= count; i += 4) {
+		__m128i product = mulloSSE2(_mm_loadu_si128((const __m128i*)&row[i]), weights);
+		_mm_storeu_si128((__m128i*)&acc[i], _mm_add_epi32(_mm_loadu_si128((const __m128i*)&acc[i]), product));
+	}
+	accumulateRowScalar(&acc[i], &row[i], weight, count - i);
+}
+
+__attribute__((target("avx2")))
+static void accumulateRowAVX2(int32_t* acc, const int32_t* row, int32_t weight, unsigned int count) {
+	const __m256i weights = _mm256_set1_epi32(weight);
+	unsigned int i = 0;
+	for(; i + 8 <= count; i += 8) {
+		__m256i product = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)&row[i]), weights);
+		_mm256_storeu_si256((__m256i*)&acc[i], _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)&acc[i]), product));
+	}
+	accumulateRowSSE2(&acc[i], &row[i], weight, count - i);
+}
+#elif defined(__ARM_NEON)
+static void shrinkRowNEON(int32_t* out, const unsigned char* row, const resampleSpan* spans, unsigned int w) {
+	for(unsigned int x = 0; x < w; ++x) {
+		const unsigned char* src = &row[spans[x].start * 4];
+		const int32_t* weights = spans[x].weights;
+		unsigned int count = spans[x].count;
+		int32x4_t sum = vdupq_n_s32(0);
+		unsigned int k = 0;
+		for(; k + 1 < count; k += 2) {
+			int16x8_t pixels = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(&src[k*4])));
+			sum = vmlal_n_s16(sum, vget_low_s16(pixels), weights[k]);
+			sum = vmlal_n_s16(sum, vget_high_s16(pixels), weights[k+1]);
+		}
+		if(k < count) {
+			int32_t sums[4];
+			vst1q_s32(sums, sum);
+			for(unsigned int c = 0; c < 4; ++c) {
+				sums[c] += src[k*4 + c] * weights[k];
+			}
+			sum = vld1q_s32(sums);
+		}
+		vst1q_s32(&out[x*4], vrshrq_n_s32(sum, RESAMPLE_SHRINK_SHIFT));
+	}
+}
+
+static void accumulateRowNEON(int32_t* acc, const int32_t* row, int32_t weight, unsigned int count) {
+	unsigned int i = 0;
+	for(; i + 4 <= count; i += 4) {
+		vst1q_s32(&acc[i], vmlaq_n_s32(vld1q_s32(&acc[i]), vld1q_s32(&row[i]), weight));
+	}
+	accumulateRowScalar(&acc[i], &row[i], weight, count - i);
+}
+#endif
+
+static shrinkRowFunc shrinkRowKernel = shrinkRowScalar;
+static accumulateRowFunc accumulateRowKernel = accumulateRowScalar;
+
+// rows of the image get handed to this one at a time as they're decoded so the full image never has to be in memory
+// (at least for PNGs, anything else still gets loaded fully and then fed through row by row)
+// rows get collected into a stripe, then the stripe is shrunk horizontally and added into every output row it
+// contributes to, both on the worker pool
+#define SAMPLER_STRIPE_ROWS 32
+
+typedef struct {
+	terminalColor* buffer;
+	unsigned int w, h;
+	resampleKernelEnum kernel;
+	workerPool* pool;
+	// set when the rows passed in stay around until the end so they don't need to be copied into the stripe
+	bool rowsPersist;
+	
+	bool initialized;
+	bool failed;
+	unsigned int imgWidth, imgHeight;
+	resampleAxis horizontal;
+	resampleAxis vertical;
+	const unsigned char* stripeRows[SAMPLER_STRIPE_ROWS];
+	unsigned int stripeY[SAMPLER_STRIPE_ROWS];
+	unsigned int stripeCount;
+	unsigned char* stripeStorage;
+	// the stripe rows after the horizontal pass
+	int32_t* shrunkRows;
+	int32_t* accumulators;
+	// output rows before this one are done and have already been written to the buffer
+	unsigned int firstActiveRow;
+	// first output row that could still use the next image row, for skipping rows nothing samples from
+	unsigned int scanRow;
+	// output rows the current stripe gets added into, split into bands for the pool
+	unsigned int bandStart, bandEnd, bandSize;
+} gridSampler;
+
+static void finishSamplerRow(gridSampler* sampler, unsigned int y) {
+	const int32_t* acc = &sampler->accumulators[(size_t)y * sampler->w * 4];
+	terminalColor* out = &sampler->buffer[(size_t)y * sampler->w];
+	const int shift = RESAMPLE_WEIGHT_BITS + RESAMPLE_MID_BITS;
+	for(unsigned int x = 0; x < sampler->w; ++x) {
+		int32_t channels[4];
+		for(unsigned int c = 0; c < 4; ++c) {
+			int32_t v = (acc[x*4 + c] + (1 << (shift - 1))) >> shift;
+			channels[c] = v < 0 ? 0 : (v > 255 ? 255 : v);
+		}
+		terminalColor color = {
+			.r=channels[0],
+			.g=channels[1],
+			.b=channels[2],
+			.a=channels[3],
+		};
+		out[x] = color;
+	}
+}
+
+static bool initSampler(gridSampler* sampler, unsigned int imgWidth, unsigned int imgHeight) {
+	sampler->initialized = true;
+	sampler->imgWidth = imgWidth;
+	sampler->imgHeight = imgHeight;
+	sampler->firstActiveRow = 0;
+	sampler->scanRow = 0;
+	sampler->stripeCount = 0;
+	if(!sampler->rowsPersist) {
+		sampler->stripeStorage = arenaMalloc((size_t)imgWidth * 4 * SAMPLER_STRIPE_ROWS);
+		if(!sampler->stripeStorage) {
+			return false;
+		}
+	}
+	sampler->shrunkRows = arenaMalloc(sizeof(int32_t) * sampler->w * 4 * SAMPLER_STRIPE_ROWS);
+	sampler->accumulators = arenaCalloc((size_t)sampler->w * sampler->h * 4, sizeof(int32_t));
+	if(!sampler->shrunkRows || !sampler->accumulators) {
+		return false;
+	}
+	if(!initResampleAxis(&sampler->horizontal, sampler->kernel, imgWidth, sampler->w)) {
+		return false;
+	}
+	return initResampleAxis(&sampler->vertical, sampler->kernel, imgHeight, sampler->h);
+}
+
+static void shrinkStripeRow(void* ctx, unsigned int index) {
+	gridSampler* sampler = ctx;
+	shrinkRowKernel(&sampler->shrunkRows[(size_t)index * sampler->w * 4], sampler->stripeRows[index], sampler->horizontal.spans, sampler->w);
+}
+
+// each band of output rows only gets touched by one job so nothing here needs locking
+static void accumulateStripeBand(void* ctx, unsigned int index) {
+	gridSampler* sampler = ctx;
+	const resampleSpan* vertical = sampler->vertical.spans;
+	unsigned int lastY = sampler->stripeY[sampler->stripeCount - 1];
+	unsigned int first = sampler->bandStart + index * sampler->bandSize;
+	unsigned int end = first + sampler->bandSize < sampler->bandEnd ? first + sampler->bandSize : sampler->bandEnd;
+	for(unsigned int y = first; y < end; ++y) {
+		int32_t* acc = &sampler->accumulators[(size_t)y * sampler->w * 4];
+		for(unsigned int i = 0; i < sampler->stripeCount; ++i) {
+			unsigned int tap = sampler->stripeY[i] - vertical[y].start;
+			if(sampler->stripeY[i] < vertical[y].start || tap >= vertical[y].count) {
+				continue;
+			}
+			accumulateRowKernel(acc, &sampler->shrunkRows[(size_t)i * sampler->w * 4], vertical[y].weights[tap], sampler->w * 4);
+		}
+		// output rows that can't get anything else added to them can be written out now
+		if(vertical[y].start + vertical[y].count <= lastY + 1) {
+			finishSamplerRow(sampler, y);
+		}
+	}
+}
+
+static void flushSamplerStripe(gridSampler* sampler) {
+	if(sampler->stripeCount == 0) {
+		return;
+	}
+	const resampleSpan* vertical = sampler->vertical.spans;
+	unsigned int lastY = sampler->stripeY[sampler->stripeCount - 1];
+	
+	workerPoolRun(sampler->pool, shrinkStripeRow, sampler, sampler->stripeCount);
+	
+	sampler->bandStart = sampler->firstActiveRow;
+	sampler->bandEnd = sampler->bandStart;
+	while(sampler->bandEnd < sampler->h && vertical[sampler->bandEnd].start <= lastY) {
+		++sampler->bandEnd;
+	}
+	unsigned int rows = sampler->bandEnd - sampler->bandStart;
+	if(rows > 0) {
+		unsigned int bands = workerPoolBandCount(sampler->pool, rows);
+		sampler->bandSize = (rows + bands - 1) / bands;
+		workerPoolRun(sampler->pool, accumulateStripeBand, sampler, (rows + sampler->bandSize - 1) / sampler->bandSize);
+	}
+	
+	while(sampler->firstActiveRow < sampler->h && vertical[sampler->firstActiveRow].start + vertical[sampler->firstActiveRow].count <= lastY + 1) {
+		++sampler->firstActiveRow;
+	}
+	sampler->stripeCount = 0;
+}
+
+void sampleRow(void* user, const unsigned char* row, int imgY, int imgWidth, int imgHeight, UNUSED int channels) {
+	gridSampler* sampler = user;
+	if(sampler->failed) {
+		return;
+	}
+	if(!sampler->initialized && !initSampler(sampler, imgWidth, imgHeight)) {
+		sampler->failed = true;
+		return;
+	}
+	
+	const resampleSpan* vertical = sampler->vertical.spans;
+	
+	// nearest neighbor skips most rows so don't bother keeping ones nothing uses
+	while(sampler->scanRow < sampler->h && vertical[sampler->scanRow].start + vertical[sampler->scanRow].count <= (unsigned int)imgY) {
+		++sampler->scanRow;
+	}
+	if(sampler->scanRow < sampler->h && vertical[sampler->scanRow].start <= (unsigned int)imgY) {
+		if(sampler->rowsPersist) {
+			sampler->stripeRows[sampler->stripeCount] = row;
+		} else {
+			unsigned char* copy = &sampler->stripeStorage[(size_t)sampler->stripeCount * imgWidth * 4];
+			memcpy(copy, row, (size_t)imgWidth * 4);
+			sampler->stripeRows[sampler->stripeCount] = copy;
+		}
+		sampler->stripeY[sampler->stripeCount++] = imgY;
+	}
+	
+	if(sampler->stripeCount == SAMPLER_STRIPE_ROWS || (unsigned int)imgY + 1 == sampler->imgHeight) {
+		flushSamplerStripe(sampler);
+	}
+	
+	if((unsigned int)imgY + 1 == sampler->imgHeight) {
+		while(sampler->firstActiveRow < sampler->h) {
+			finishSamplerRow(sampler, sampler->firstActiveRow++);
+		}
+	}
+}
+
+static void resetSampler(gridSampler* sampler) {
+	if(sampler->initialized) {
+		freeResampleAxis(&sampler->horizontal);
+		freeResampleAxis(&sampler->vertical);
+		arenaFree(sampler->stripeStorage);
+		arenaFree(sampler->shrunkRows);
+		arenaFree(sampler->accumulators);
+	}
+	sampler->initialized = false;
+	sampler->failed = false;
+	sampler->stripeStorage = NULL;
+	sampler->shrunkRows = NULL;
+	sampler->accumulators = NULL;
+}
+
+// lets the same sampler (and the weight tables it built) get used again for another image of the same size
+static void rewindSampler(gridSampler* sampler) {
+	if(!sampler->initialized) {
+		return;
+	}
+	memset(sampler->accumulators, 0, sizeof(int32_t) * sampler->w * sampler->h * 4);
+	sampler->firstActiveRow = 0;
+	sampler->scanRow = 0;
+	sampler->stripeCount = 0;
+}
+
+// roughly how many pixels of decoding/resampling work it takes before another thread is worth waking up
+#define PLAN_PIXELS_PER_THREAD (1 << 16)
+
+// everything about how the image gets decoded, worked out from just the header before touching any pixels
+typedef struct {
+	// as stored in the file
+	unsigned int imgWidth, imgHeight;
+	unsigned int channels;
+	// what the decoder will actually hand over, smaller than the file for jpegs decoded at reduced size
+	unsigned int decodeWidth, decodeHeight;
+	// in pixels, so twice the cell rows in half block mode
+	unsigned int gridWidth, gridHeight;
+	// rows can go straight from the decoder into the sampler without loading the whole image
+	bool stream;
+	bool animated;
+	// some terminals can be handed these as they are
+	bool png, jpeg;
+	// progressive jpegs and interlaced pngs can be shown roughly before they're finished decoding
+	bool progressive;
+	resampleKernelEnum kernel;
+	unsigned int threads;
+} decodePlan;
+
+bool planDecode(decodePlan* plan, const inputFile* input, unsigned int w, unsigned int h, resampleKernelEnum kernel, unsigned int threads) {
+	stbi_probe probe;
+	if(!stbi_probe_from_memory(input->data, input->size, &probe)) {
+		printError("Couldn't load image at location \"%s\"\n", input->path);
+		return false;
+	}
+	
+	plan->imgWidth = probe.x;
+	plan->imgHeight = probe.y;
+	plan->channels = probe.comp;
+	plan->gridWidth = w;
+	plan->gridHeight = h;
+	plan->animated = probe.frames > 1;
+	plan->png = probe.is_png;
+	plan->jpeg = probe.is_jpeg;
+	// interlaced gifs count as progressive to the probe too, but the gif loader never hands out previews
+	plan->progressive = probe.progressive && (probe.is_jpeg || probe.is_png) && !plan->animated;
+	// only 8 bit pngs can be streamed, some low bit depth ones still get turned away by the decoder but that happens before any pixels
+	plan->stream = probe.is_png && !probe.progressive && !probe.is_16_bit;
+	
+	// same choice stbi_load_reduced_from_memory makes: the smallest of 1/2, 1/4 or 1/8 that still covers the grid
+	plan->decodeWidth = plan->imgWidth;
+	plan->decodeHeight = plan->imgHeight;
+	if(probe.is_jpeg) {
+		for(unsigned int shift = 1; shift <= 3; ++shift) {
+			unsigned int scaledWidth = (plan->imgWidth + (1u << shift) - 1) >> shift;
+			unsigned int scaledHeight = (plan->imgHeight + (1u << shift) - 1) >> shift;
+			if(scaledWidth < w || scaledHeight < h) {
+				break;
+			}
+			plan->decodeWidth = scaledWidth;
+			plan->decodeHeight = scaledHeight;
+		}
+	}
+	
+	// every kernel gives the same result when there's nothing to scale, so don't bother with the expensive ones
+	plan->kernel = kernel;
+	if(plan->decodeWidth == w && plan->decodeHeight == h) {
+		plan->kernel = RESAMPLE_NEAREST;
+	}
+	
+	// small images are done before the extra threads would even get going
+	// jpegs still go through every coefficient at full size even when the idct is smaller, and with restart markers that gets split up too
+	size_t work = (size_t)plan->decodeWidth * plan->decodeHeight + (size_t)w * h;
+	if(probe.is_jpeg) {
+		work += (size_t)plan->imgWidth * plan->imgHeight;
+	}
+	plan->threads = threads;
+	if(work / PLAN_PIXELS_PER_THREAD < plan->threads) {
+		plan->threads = work / PLAN_PIXELS_PER_THREAD;
+	}
+	if(plan->threads < 1) {
+		plan->threads = 1;
+	}
+	
+	return true;
+}
+
+// gets the buffer filled in from a partly decoded image, once per progressive jpeg scan or interlaced png pass
+typedef void (*previewFunc)(void* user, const terminalColor* buffer);
+
+typedef struct {
+	gridSampler* sampler;
+	previewFunc preview;
+	void* user;
+} previewSampler;
+
+static void samplePreviewPass(void* user, const unsigned char* pixels, int imgWidth, int imgHeight, int channels, UNUSED int pass) {
+	previewSampler* preview = user;
+	rewindSampler(preview->sampler);
+	for(int y = 0; y < imgHeight; ++y) {
+		sampleRow(preview->sampler, &pixels[(size_t)y*imgWidth*4], y, imgWidth, imgHeight, channels);
+	}
+	if(!preview->sampler->failed) {
+		preview->preview(preview->user, preview->sampler->buffer);
+	}
+}
+
+// preview can be NULL, otherwise it gets called with the rough versions of progressive images on the way to the final one
+bool loadPNGtoBuffer(const inputFile* input, terminalColor* buffer, const decodePlan* plan, workerPool* pool, previewFunc preview, void* previewUser) {
+	gridSampler sampler = {
+		.buffer = buffer,
+		.w = plan->gridWidth,
+		.h = plan->gridHeight,
+		.kernel = plan->kernel,
+		.pool = pool,
+	};
+	
+	if(plan->stream) {
+		if(stbi_load_rows_from_memory(input->data, input->size, 4, sampleRow, &sampler) && !sampler.failed) {
+			resetSampler(&sampler);
+			return true;
+		}
+		// might have gotten partway through before finding out it couldn't be streamed
+		resetSampler(&sampler);
+	}
+	
+	// can't be streamed, just load the whole thing
+	// jpegs skip most of the idct work by decoding at the reduced size the plan picked
+	sampler.rowsPersist = true;
+	int imgWidth, imgHeight, channels;
+	unsigned char* data;
+	if(preview && plan->progressive) {
+		previewSampler previewPass = {
+			.sampler = &sampler,
+			.preview = preview,
+			.user = previewUser,
+		};
+		data = stbi_load_progressive_from_memory(input->data, input->size, &imgWidth, &imgHeight, &channels, 4, plan->decodeWidth, plan->decodeHeight, samplePreviewPass, &previewPass);
+		rewindSampler(&sampler);
+	} else {
+		data = stbi_load_reduced_from_memory(input->data, input->size, &imgWidth, &imgHeight, &channels, 4, plan->decodeWidth, plan->decodeHeight);
+	}
+	
+	if(!data) {
+		resetSampler(&sampler);
+		printError("Couldn't load image at location \"%s\"\n", input->path);
+		return false;
+	}
+	
+	for(int y = 0; y < imgHeight; ++y) {
+		sampleRow(&sampler, &data[(size_t)y*imgWidth*4], y, imgWidth, imgHeight, channels);
+	}
+	
+	stbi_image_free(data);
+	bool failed = sampler.failed;
+	resetSampler(&sampler);
+	if(failed) {
+		printError("Couldn't allocate memory for resampling\n");
+		return false;
+	}
+	return true;
+}
+
+// colors are based on the color scheme of my terminal (the default one that comes with kitty)
+// if you want it to have your color scheme you'd need to edit these yourself
+terminalColor colorLUT[256] = {
+	{0x00,0x00,0x00,0xff},  // black
+	{0xcd,0x00,0x00,0xff},  // red
+	{0x00,0xcd,0x00,0xff},  // green
+	{0xcd,0xcd,0x00,0xff},  // yellow
+	{0x00,0x00,0xee,0xff},  // blue
+	{0xcd,0x00,0xcd,0xff},  // magenta
+	{0x00,0xcd,0xcd,0xff},  // cyan
+	{0xe5,0xe5,0xe5,0xff},  // white
+	{0x7f,0x7f,0x7f,0xff},  // bright black
+	{0xff,0x00,0x00,0xff},  // bright red
+	{0x00,0xff,0x00,0xff},  // bright green
+	{0xff,0xff,0x00,0xff},  // bright yellow
+	{0x5c,0x5c,0xff,0xff},  // bright blue
+	{0xff,0x00,0xff,0xff},  // bright magenta
+	{0x00,0xff,0xff,0xff},  // bright cyan
+	{0xff,0xff,0xff,0xff},  // bright white
+};
+
+
+// basically copied from https://github.com/kovidgoyal/kitty/blob/master/kitty/colors.c
+void initLUT() {
+	uint8_t offset = 16;
+	// 6x6x6 color cube
+	uint8_t valueRange[6] = {0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff};
+	for(uint8_t i = 0; i < 216; ++i) {
+		terminalColor c = {
+			valueRange[(i / 36) % 6],
+			valueRange[(i /  6) % 6],
+			valueRange[ i       % 6],
+			0xff,
+		};
+		colorLUT[i+offset] = c;
+	}
+
+	// grayscale
+	offset = 232;
+	for(uint8_t i = 0; i < 24; ++i) {
+		uint8_t v = 8 + i * 10;
+		terminalColor c = {
+			v,
+			v,
+			v,
+			0xff,
+		};
+		colorLUT[i+offset] = c;
+	}
+}
+
+// searching through the whole LUT for every pixel was really slow in 256 color mode
+// so every color gets mapped to the closest LUT entry once at startup and looked up with the top bits of each channel
+#define PALETTE_CUBE_BITS 5
+#define PALETTE_CUBE_SIZE (1 << PALETTE_CUBE_BITS)
+
+typedef struct {
+	uint8_t index[PALETTE_CUBE_SIZE * PALETTE_CUBE_SIZE * PALETTE_CUBE_SIZE];
+	// so the avx2 lookup can read 4 bytes starting at the last entry
+	uint8_t gatherPadding[3];
+} paletteCube;
+
+static inline unsigned int paletteCubeIndex(unsigned int r, unsigned int g, unsigned int b) {
+	return (r << (PALETTE_CUBE_BITS * 2)) | (g << PALETTE_CUBE_BITS) | b;
+}
+
+void initPaletteCube(paletteCube* cube, terminalColor* lut, size_t lutSize) {
+	static uint32_t bestDistance[PALETTE_CUBE_SIZE * PALETTE_CUBE_SIZE * PALETTE_CUBE_SIZE];
+	memset(bestDistance, 0xff, sizeof(bestDistance));
+	memset(cube->index, 0, sizeof(cube->index));
+	
+	for(size_t i = 0; i < lutSize; ++i) {
+		// the distance is just a sum of the channels so each channel can be worked out on its own first
+		uint32_t distanceR[PALETTE_CUBE_SIZE];
+		uint32_t distanceG[PALETTE_CUBE_SIZE];
+		uint32_t distanceB[PALETTE_CUBE_SIZE];
+		for(unsigned int v = 0; v < PALETTE_CUBE_SIZE; ++v) {
+			// compare against the middle of the range of colors that end up in this spot
+			int center = (v << (8 - PALETTE_CUBE_BITS)) | (1 << (7 - PALETTE_CUBE_BITS));
+			// signed int so it doesn't underflow if lut[i] is greater, will always be positive when squared
+			int deltaR = center - (int)lut[i].r;
+			int deltaG = center - (int)lut[i].g;
+			int deltaB = center - (int)lut[i].b;
+			// https://stackoverflow.com/questions/4485229/rgb-to-closest-predefined-color
+			// still doesn't work perfectly but seems to not be going to gray as much
+			distanceR[v] = deltaR*deltaR*299;
+			distanceG[v] = deltaG*deltaG*587;
+			distanceB[v] = deltaB*deltaB*114;
+		}
+		
+		for(unsigned int r = 0; r < PALETTE_CUBE_SIZE; ++r) {
+			for(unsigned int g = 0; g < PALETTE_CUBE_SIZE; ++g) {
+				uint32_t distanceRG = distanceR[r] + distanceG[g];
+				unsigned int base = paletteCubeIndex(r, g, 0);
+				for(unsigned int b = 0; b < PALETTE_CUBE_SIZE; ++b) {
+					uint32_t distance = distanceRG + distanceB[b];
+					if(distance < bestDistance[base + b]) {
+						bestDistance[base + b] = distance;
+						cube->index[base + b] = i;
+					}
+				}
+			}
+		}
+	}
+}
+
+// what actually ends up in a cell after picking the color for it
+// either 0xRRGGBB, a palette index with CELL_COLOR_INDEXED set, or CELL_COLOR_DEFAULT to show the terminal background
+typedef uint32_t cellColor;
+#define CELL_COLOR_INDEXED 0x01000000
+#define CELL_COLOR_DEFAULT 0x02000000
+// used for when nothing has been emitted yet so the first cell always sets its color
+#define CELL_COLOR_UNKNOWN 0xffffffff
+
+// how many pixels each cell shows, with block characters splitting it up between the foreground and background color.
+// past half blocks there are more pixels than colors so the two colors get fitted to them
+typedef enum {
+	BLOCKS_NONE,
+	BLOCKS_HALF,
+	BLOCKS_QUADRANT,
+	BLOCKS_SEXTANT,
+	BLOCKS_OCTANT,
+} blockModeEnum;
+
+static const unsigned int blockColumns[] = {1, 1, 2, 2, 2};
+static const unsigned int blockRows[] = {1, 2, 2, 3, 4};
+
+// the octants that were already in unicode before the rest of them were added, in order
+static const struct {
+	uint8_t mask;
+	uint32_t glyph;
+} octantsElsewhere[] = {
+	{0x01, 0x1cea8}, {0x02, 0x1ceab}, {0x03, 0x1fb82}, {0x14, 0x1fbe6}, {0x28, 0x1fbe7},
+	{0x3f, 0x1fb85}, {0x40, 0x1cea3}, {0x80, 0x1cea0}, {0xc0, 0x2582}, {0xfc, 0x2586},
+};
+
+// the character with the foreground everywhere mask has a bit set, the bits go left to right and then top to bottom
+static uint32_t blockGlyph(blockModeEnum blocks, unsigned int mask) {
+	static const uint16_t quadrants[16] = {
+		' ', 0x2598, 0x259d, 0x2580, 0x2596, 0x258c, 0x259e, 0x259b,
+		0x2597, 0x259a, 0x2590, 0x259c, 0x2584, 0x2599, 0x259f, 0x2588,
+	};
+	unsigned int full = (1u << (blockColumns[blocks] * blockRows[blocks])) - 1;
+	if(mask == 0) {
+		return ' ';
+	}
+	if(mask == full) {
+		return 0x2588;
+	}
+	switch(blocks) {
+		case BLOCKS_HALF:
+			return mask == 1 ? 0x2580 : 0x2584;
+		case BLOCKS_QUADRANT:
+			return quadrants[mask];
+		case BLOCKS_SEXTANT:
+			// sextants are in order apart from the left and right halves, which already had their own
+			if(mask == 0x15) { return 0x258c; }
+			if(mask == 0x2a) { return 0x2590; }
+			return 0x1fb00 + mask - 1 - (mask > 0x15) - (mask > 0x2a);
+		case BLOCKS_OCTANT: {
+			// anything with the same top two and bottom two rows is a quadrant
+			unsigned int top = mask & 3, bottom = (mask >> 4) & 3;
+			if(top == ((mask >> 2) & 3) && bottom == mask >> 6) {
+				return quadrants[top | bottom << 2];
+			}
+			// octants are in order too, once everything that's somewhere else is taken out
+			unsigned int skipped = 0;
+			for(unsigned int q = 1; q < 15; ++q) {
+				unsigned int quadrant = (q & 3) * 0x05 + (q >> 2) * 0x50;
+				skipped += quadrant < mask;
+			}
+			for(unsigned int i = 0; i < sizeof(octantsElsewhere) / sizeof(octantsElsewhere[0]); ++i) {
+				if(octantsElsewhere[i].mask == mask) {
+					return octantsElsewhere[i].glyph;
+				}
+				skipped += octantsElsewhere[i].mask < mask;
+			}
+			return 0x1cd00 + mask - 1 - skipped;
+		}
+		default:
+			return ' ';
+	}
+}
+
+static inline void appendCursorMove(frameBuffer* frame, unsigned int x, unsigned int y) {
+	frameAppendLiteral(frame, "\033[");
+	frameAppendUInt(frame, y);
+	frameAppendLiteral(frame, ";");
+	frameAppendUInt(frame, x);
+	frameAppendLiteral(frame, "H");
+}
+
+// the background version uses a full reset for the default color since that's what the one pixel per cell mode always did,
+// this one only ever gets used by the half block mode which resets the background on its own
+static inline void appendForegroundColor(frameBuffer* frame, cellColor color) {
+	if(color & CELL_COLOR_INDEXED) {
+		frameAppendLiteral(frame, "\033[38;5;");
+		frameAppendUInt(frame, color & 0xff);
+		frameAppendLiteral(frame, "m");
+	} else {
+		frameAppendLiteral(frame, "\033[38;2;");
+		frameAppendUInt(frame, (color >> 16) & 0xff);
+		frameAppendLiteral(frame, ";");
+		frameAppendUInt(frame, (color >> 8) & 0xff);
+		frameAppendLiteral(frame, ";");
+		frameAppendUInt(frame, color & 0xff);
+		frameAppendLiteral(frame, "m");
+	}
+}
+
+static inline void appendBackgroundColor(frameBuffer* frame, cellColor color) {
+	if(color == CELL_COLOR_DEFAULT) {
+		// to make it show the actual terminal background
+		frameAppendLiteral(frame, "\033[0m");
+	} else if(color & CELL_COLOR_INDEXED) {
+		frameAppendLiteral(frame, "\033[48;5;");
+		frameAppendUInt(frame, color & 0xff);
+		frameAppendLiteral(frame, "m");
+	} else {
+		frameAppendLiteral(frame, "\033[48;2;");
+		frameAppendUInt(frame, (color >> 16) & 0xff);
+		frameAppendLiteral(frame, ";");
+		frameAppendUInt(frame, (color >> 8) & 0xff);
+		frameAppendLiteral(frame, ";");
+		frameAppendUInt(frame, color & 0xff);
+		frameAppendLiteral(frame, "m");
+	}
+}
+
+// kinda dumb to have these unused parameters at the end but it's so that I don't get warnings when I assign the function pointer later
+// since I'm assigning the function pointer with either this or the LUT function to avoid having to check the color mode every time in the loop
+typedef void (*quantizeRowFunc)(cellColor* out, const terminalColor* row, unsigned int w, const paletteCube* cube);
+
+// arbitrary cutoff point
+#define ALPHA_CUTOFF 250
+
+void quantizeRow(cellColor* out, const terminalColor* row, unsigned int w, UNUSED const paletteCube* cube) {
+	for(unsigned int x = 0; x < w; ++x) {
+		terminalColor c = row[x];
+		out[x] = c.a < ALPHA_CUTOFF ? CELL_COLOR_DEFAULT : (c.r << 16) | (c.g << 8) | c.b;
+	}
+}
+
+void quantizeRowWithLUT(cellColor* out, const terminalColor* row, unsigned int w, const paletteCube* cube) {
+	const unsigned int shift = 8 - PALETTE_CUBE_BITS;
+	for(unsigned int x = 0; x < w; ++x) {
+		terminalColor c = row[x];
+		if(c.a < ALPHA_CUTOFF) {
+			out[x] = CELL_COLOR_DEFAULT;
+		} else {
+			out[x] = CELL_COLOR_INDEXED | cube->index[paletteCubeIndex(c.r >> shift, c.g >> shift, c.b >> shift)];
+		}
+	}
+}
+
+#if defined(__SSE2__)
+static inline __m128i selectSSE2(__m128i mask, __m128i ifSet, __m128i ifClear) {
+	return _mm_or_si128(_mm_and_si128(mask, ifSet), _mm_andnot_si128(mask, ifClear));
+}
+
+// pixels come in as 0xAABBGGRR, cells want 0xRRGGBB so r and b have to swap places
+static inline __m128i packRGBSSE2(__m128i pixels) {
+	const __m128i greenMask = _mm_set1_epi32(0x0000ff00);
+	const __m128i byteMask = _mm_set1_epi32(0xff);
+	__m128i r = _mm_slli_epi32(_mm_and_si128(pixels, byteMask), 16);
+	__m128i b = _mm_and_si128(_mm_srli_epi32(pixels, 16), byteMask);
+	return _mm_or_si128(_mm_or_si128(r, _mm_and_si128(pixels, greenMask)), b);
+}
+
+void quantizeRowSSE2(cellColor* out, const terminalColor* row, unsigned int w, const paletteCube* cube) {
+	const __m128i cutoff = _mm_set1_epi32(ALPHA_CUTOFF);
+	const __m128i transparentColor = _mm_set1_epi32(CELL_COLOR_DEFAULT);
+	unsigned int x = 0;
+	for(; x + 4 <= w; x += 4) {
+		__m128i pixels = _mm_loadu_si128((const __m128i*)&row[x]);
+		__m128i transparent = _mm_cmplt_epi32(_mm_srli_epi32(pixels, 24), cutoff);
+		_mm_storeu_si128((__m128i*)&out[x], selectSSE2(transparent, transparentColor, packRGBSSE2(pixels)));
+	}
+	quantizeRow(&out[x], &row[x], w - x, cube);
+}
+
+// top PALETTE_CUBE_BITS of each channel put together the same way paletteCubeIndex does it
+static inline __m128i cubeIndexSSE2(__m128i pixels) {
+	const int shift = 8 - PALETTE_CUBE_BITS;
+	const __m128i channelMask = _mm_set1_epi32(PALETTE_CUBE_SIZE - 1);
+	__m128i r = _mm_and_si128(_mm_srli_epi32(pixels, shift), channelMask);
+	__m128i g = _mm_and_si128(_mm_srli_epi32(pixels, 8 + shift), channelMask);
+	__m128i b = _mm_and_si128(_mm_srli_epi32(pixels, 16 + shift), channelMask);
+	return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, PALETTE_CUBE_BITS * 2), _mm_slli_epi32(g, PALETTE_CUBE_BITS)), b);
+}
+
+// sse2 has no gather so the cube index gets worked out 4 at a time and then looked up one by one
+void quantizeRowWithLUTSSE2(cellColor* out, const terminalColor* row, unsigned int w, const paletteCube* cube) {
+	const __m128i cutoff = _mm_set1_epi32(ALPHA_CUTOFF);
+	unsigned int x = 0;
+	for(; x + 4 <= w; x += 4) {
+		__m128i pixels = _mm_loadu_si128((const __m128i*)&row[x]);
+		uint32_t indices[4], transparent[4];
+		_mm_storeu_si128((__m128i*)indices, cubeIndexSSE2(pixels));
+		_mm_storeu_si128((__m128i*)transparent, _mm_cmplt_epi32(_mm_srli_epi32(pixels, 24), cutoff));
+		for(unsigned int i = 0; i < 4; ++i) {
+			out[x + i] = transparent[i] ? CELL_COLOR_DEFAULT : CELL_COLOR_INDEXED | cube->index[indices[i]];
+		}
+	}
+	quantizeRowWithLUT(&out[x], &row[x], w - x, cube);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i packRGBAVX2(__m256i pixels) {
+	const __m256i greenMask = _mm256_set1_epi32(0x0000ff00);
+	const __m256i byteMask = _mm256_set1_epi32(0xff);
+	__m256i r = _mm256_slli_epi32(_mm256_and_si256(pixels, byteMask), 16);
+	__m256i b = _mm256_and_si256(_mm256_srli_epi32(pixels, 16), byteMask);
+	return _mm256_or_si256(_mm256_or_si256(r, _mm256_and_si256(pixels, greenMask)), b);
+}
+
+__attribute__((target("avx2")))
+void quantizeRowAVX2(cellColor* out, const terminalColor* row, unsigned int w, const paletteCube* cube) {
+	const __m256i cutoff = _mm256_set1_epi32(ALPHA_CUTOFF);
+	const __m256i transparentColor = _mm256_set1_epi32(CELL_COLOR_DEFAULT);
+	unsigned int x = 0;
+	for(; x + 8 <= w; x += 8) {
+		__m256i pixels = _mm256_loadu_si256((const __m256i*)&row[x]);
+		__m256i transparent = _mm256_cmpgt_epi32(cutoff, _mm256_srli_epi32(pixels, 24));
+		_mm256_storeu_si256((__m256i*)&out[x], _mm256_blendv_epi8(packRGBAVX2(pixels), transparentColor, transparent));
+	}
+	quantizeRowSSE2(&out[x], &row[x], w - x, cube);
+}
+
+// the gather reads 4 bytes for every entry, paletteCube has padding at the end so the last few are still in bounds
+__attribute__((target("avx2")))
+void quantizeRowWithLUTAVX2(cellColor* out, const terminalColor* row, unsigned int w, const paletteCube* cube) {
+	const int shift = 8 - PALETTE_CUBE_BITS;
+	const __m256i cutoff = _mm256_set1_epi32(ALPHA_CUTOFF);
+	const __m256i transparentColor = _mm256_set1_epi32(CELL_COLOR_DEFAULT);
+	const __m256i indexed = _mm256_set1_epi32(CELL_COLOR_INDEXED);
+	const __m256i byteMask = _mm256_set1_epi32(0xff);
+	const __m256i channelMask = _mm256_set1_epi32(PALETTE_CUBE_SIZE - 1);
+	unsigned int x = 0;
+	for(; x + 8 <= w; x += 8) {
+		__m256i pixels = _mm256_loadu_si256((const __m256i*)&row[x]);
+		__m256i r = _mm256_and_si256(_mm256_srli_epi32(pixels, shift), channelMask);
+		__m256i g = _mm256_and_si256(_mm256_srli_epi32(pixels, 8 + shift), channelMask);
+		__m256i b = _mm256_and_si256(_mm256_srli_epi32(pixels, 16 + shift), channelMask);
+		__m256i index = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, PALETTE_CUBE_BITS * 2), _mm256_slli_epi32(g, PALETTE_CUBE_BITS)), b);
+		__m256i entry = _mm256_and_si256(_mm256_i32gather_epi32((const int*)cube->index, index, 1), byteMask);
+		entry = _mm256_or_si256(entry, indexed);
+		__m256i transparent = _mm256_cmpgt_epi32(cutoff, _mm256_srli_epi32(pixels, 24));
+		_mm256_storeu_si256((__m256i*)&out[x], _mm256_blendv_epi8(entry, transparentColor, transparent));
+	}
+	quantizeRowWithLUTSSE2(&out[x], &row[x], w - x, cube);
+}
+#elif defined(__ARM_NEON)
+void quantizeRowNEON(cellColor* out, const terminalColor* row, unsigned int w, const paletteCube* cube) {
+	const uint32x4_t cutoff = vdupq_n_u32(ALPHA_CUTOFF);
+	const uint32x4_t transparentColor = vdupq_n_u32(CELL_COLOR_DEFAULT);
+	const uint32x4_t byteMask = vdupq_n_u32(0xff);
+	const uint32x4_t greenMask = vdupq_n_u32(0x0000ff00);
+	unsigned int x = 0;
+	for(; x + 4 <= w; x += 4) {
+		uint32x4_t pixels = vld1q_u32((const uint32_t*)&row[x]);
+		uint32x4_t r = vshlq_n_u32(vandq_u32(pixels, byteMask), 16);
+		uint32x4_t b = vandq_u32(vshrq_n_u32(pixels, 16), byteMask);
+		uint32x4_t rgb = vorrq_u32(vorrq_u32(r, vandq_u32(pixels, greenMask)), b);
+		vst1q_u32(&out[x], vbslq_u32(vcltq_u32(vshrq_n_u32(pixels, 24), cutoff), transparentColor, rgb));
+	}
+	quantizeRow(&out[x], &row[x], w - x, cube);
+}
+
+void quantizeRowWithLUTNEON(cellColor* out, const terminalColor* row, unsigned int w, const paletteCube* cube) {
+	const int shift = 8 - PALETTE_CUBE_BITS;
+	const uint32x4_t cutoff = vdupq_n_u32(ALPHA_CUTOFF);
+	const uint32x4_t channelMask = vdupq_n_u32(PALETTE_CUBE_SIZE - 1);
+	unsigned int x = 0;
+	for(; x + 4 <= w; x += 4) {
+		uint32x4_t pixels = vld1q_u32((const uint32_t*)&row[x]);
+		uint32x4_t r = vandq_u32(vshrq_n_u32(pixels, shift), channelMask);
+		uint32x4_t g = vandq_u32(vshrq_n_u32(pixels, 8 + shift), channelMask);
+		uint32x4_t b = vandq_u32(vshrq_n_u32(pixels, 16 + shift), channelMask);
+		uint32x4_t index = vorrq_u32(vorrq_u32(vshlq_n_u32(r, PALETTE_CUBE_BITS * 2), vshlq_n_u32(g, PALETTE_CUBE_BITS)), b);
+		uint32_t indices[4], transparent[4];
+		vst1q_u32(indices, index);
+		vst1q_u32(transparent, vcltq_u32(vshrq_n_u32(pixels, 24), cutoff));
+		for(unsigned int i = 0; i < 4; ++i) {
+			out[x + i] = transparent[i] ? CELL_COLOR_DEFAULT : CELL_COLOR_INDEXED | cube->index[indices[i]];
+		}
+	}
+	quantizeRowWithLUT(&out[x], &row[x], w - x, cube);
+}
+#endif
+
+static quantizeRowFunc quantizeRowKernel = quantizeRow;
+static quantizeRowFunc quantizeRowWithLUTKernel = quantizeRowWithLUT;
+
+// the block modes fit two colors to each cell by trying every way of splitting its pixels into two groups, where each
+// group shows the average of its pixels. the squared error of a split is the same for every split apart from taking
+// away |sum of a|² / count of a + |sum of b|² / count of b, so whichever has the biggest of that wins. a split with
+// the last pixel in the foreground is the same as one without it with the colors swapped, so those aren't tried
+#define BLOCK_MAX_PIXELS 8
+#define BLOCK_MAX_SPLITS (1 << (BLOCK_MAX_PIXELS - 1))
+
+typedef struct {
+	// 1 / how many pixels are on each side of every split, 0 when there aren't any
+	float foregroundWeights[BLOCK_MAX_SPLITS];
+	float backgroundWeights[BLOCK_MAX_SPLITS];
+	unsigned int pixels;
+	// always a multiple of 4 for the vector versions
+	unsigned int splits;
+} blockSplitTable;
+
+void initBlockSplitTable(blockSplitTable* table, unsigned int pixels) {
+	table->pixels = pixels;
+	table->splits = 1u << (pixels - 1);
+	for(unsigned int mask = 0; mask < table->splits; ++mask) {
+		unsigned int count = __builtin_popcount(mask);
+		table->foregroundWeights[mask] = count ? 1.0f / count : 0.0f;
+		table->backgroundWeights[mask] = 1.0f / (pixels - count);
+	}
+}
+
+// pixels is r, g, b for every pixel in the cell, returns which ones go in the foreground
+typedef unsigned int (*blockSplitFunc)(const blockSplitTable* table, const float* pixels);
+
+// the foreground sums for every split, each one is a smaller split plus one more pixel so they're built up doubling
+// the number done each time. they're all whole numbers well under 2^24 so the order they're added in doesn't matter
+static unsigned int sumBlockSplits(float sums[3][BLOCK_MAX_SPLITS], float totals[3], const float* pixels, const blockSplitTable* table, unsigned int upTo) {
+	for(unsigned int c = 0; c < 3; ++c) {
+		sums[c][0] = 0.0f;
+		totals[c] = 0.0f;
+		for(unsigned int i = 0; i < table->pixels; ++i) {
+			totals[c] += pixels[i * 3 + c];
+		}
+	}
+	unsigned int half = 1, pixel = 0;
+	for(; half < upTo && half < table->splits; half <<= 1, ++pixel) {
+		for(unsigned int mask = 0; mask < half; ++mask) {
+			for(unsigned int c = 0; c < 3; ++c) {
+				sums[c][half + mask] = sums[c][mask] + pixels[pixel * 3 + c];
+			}
+		}
+	}
+	return half;
+}
+
+unsigned int bestBlockSplit(const blockSplitTable* table, const float* pixels) {
+	float sums[3][BLOCK_MAX_SPLITS];
+	float totals[3];
+	sumBlockSplits(sums, totals, pixels, table, BLOCK_MAX_SPLITS);
+	unsigned int best = 0;
+	float bestScore = -1.0f;
+	for(unsigned int mask = 0; mask < table->splits; ++mask) {
+		float r = sums[0][mask], g = sums[1][mask], b = sums[2][mask];
+		float otherR = totals[0] - r, otherG = totals[1] - g, otherB = totals[2] - b;
+		float score = (r * r + g * g + b * b) * table->foregroundWeights[mask] + (otherR * otherR + otherG * otherG + otherB * otherB) * table->backgroundWeights[mask];
+		if(score > bestScore) {
+			bestScore = score;
+			best = mask;
+		}
+	}
+	return best;
+}
+
+// each lane keeps the first best split it saw, so picking the lowest of the ones tied at the end matches the scalar version
+static unsigned int pickBlockSplit(const float* scores, const uint32_t* masks) {
+	unsigned int best = 0;
+	for(unsigned int i = 1; i < 4; ++i) {
+		if(scores[i] > scores[best] || (scores[i] == scores[best] && masks[i] < masks[best])) {
+			best = i;
+		}
+	}
+	return masks[best];
+}
+
+#if defined(__SSE2__)
+unsigned int bestBlockSplitSSE2(const blockSplitTable* table, const float* pixels) {
+	float sums[3][BLOCK_MAX_SPLITS];
+	float totals[3];
+	unsigned int half = sumBlockSplits(sums, totals, pixels, table, 4);
+	for(unsigned int pixel = 2; half < table->splits; half <<= 1, ++pixel) {
+		for(unsigned int c = 0; c < 3; ++c) {
+			__m128 value = _mm_set1_ps(pixels[pixel * 3 + c]);
+			for(unsigned int mask = 0; mask < half; mask += 4) {
+				_mm_storeu_ps(&sums[c][half + mask], _mm_add_ps(_mm_loadu_ps(&sums[c][mask]), value));
+			}
+		}
+	}
+	
+	const __m128 totalR = _mm_set1_ps(totals[0]), totalG = _mm_set1_ps(totals[1]), totalB = _mm_set1_ps(totals[2]);
+	__m128 bestScores = _mm_set1_ps(-1.0f);
+	__m128i bestMasks = _mm_setzero_si128();
+	__m128i masks = _mm_setr_epi32(0, 1, 2, 3);
+	for(unsigned int mask = 0; mask < table->splits; mask += 4) {
+		__m128 r = _mm_loadu_ps(&sums[0][mask]), g = _mm_loadu_ps(&sums[1][mask]), b = _mm_loadu_ps(&sums[2][mask]);
+		__m128 otherR = _mm_sub_ps(totalR, r), otherG = _mm_sub_ps(totalG, g), otherB = _mm_sub_ps(totalB, b);
+		__m128 foreground = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(g, g)), _mm_mul_ps(b, b));
+		__m128 background = _mm_add_ps(_mm_add_ps(_mm_mul_ps(otherR, otherR), _mm_mul_ps(otherG, otherG)), _mm_mul_ps(otherB, otherB));
+		__m128 score = _mm_add_ps(_mm_mul_ps(foreground, _mm_loadu_ps(&table->foregroundWeights[mask])), _mm_mul_ps(background, _mm_loadu_ps(&table->backgroundWeights[mask])));
+		__m128 better = _mm_cmpgt_ps(score, bestScores);
+		bestScores = _mm_or_ps(_mm_and_ps(better, score), _mm_andnot_ps(better, bestScores));
+		bestMasks = selectSSE2(_mm_castps_si128(better), masks, bestMasks);
+		masks = _mm_add_epi32(masks, _mm_set1_epi32(4));
+	}
+	float scores[4];
+	uint32_t lanes[4];
+	_mm_storeu_ps(scores, bestScores);
+	_mm_storeu_si128((__m128i*)lanes, bestMasks);
+	return pickBlockSplit(scores, lanes);
+}
+#elif defined(__ARM_NEON)
+unsigned int bestBlockSplitNEON(const blockSplitTable* table, const float* pixels) {
+	float sums[3][BLOCK_MAX_SPLITS];
+	float totals[3];
+	unsigned int half = sumBlockSplits(sums, totals, pixels, table, 4);
+	for(unsigned int pixel = 2; half < table->splits; half <<= 1, ++pixel) {
+		for(unsigned int c = 0; c < 3; ++c) {
+			float32x4_t value = vdupq_n_f32(pixels[pixel * 3 + c]);
+			for(unsigned int mask = 0; mask < half; mask += 4) {
+				vst1q_f32(&sums[c][half + mask], vaddq_f32(vld1q_f32(&sums[c][mask]), value));
+			}
+		}
+	}
+	
+	const float32x4_t totalR = vdupq_n_f32(totals[0]), totalG = vdupq_n_f32(totals[1]), totalB = vdupq_n_f32(totals[2]);
+	float32x4_t bestScores = vdupq_n_f32(-1.0f);
+	uint32x4_t bestMasks = vdupq_n_u32(0);
+	const uint32_t first[4] = {0, 1, 2, 3};
+	uint32x4_t masks = vld1q_u32(first);
+	for(unsigned int mask = 0; mask < table->splits; mask += 4) {
+		float32x4_t r = vld1q_f32(&sums[0][mask]), g = vld1q_f32(&sums[1][mask]), b = vld1q_f32(&sums[2][mask]);
+		float32x4_t otherR = vsubq_f32(totalR, r), otherG = vsubq_f32(totalG, g), otherB = vsubq_f32(totalB, b);
+		float32x4_t foreground = vaddq_f32(vaddq_f32(vmulq_f32(r, r), vmulq_f32(g, g)), vmulq_f32(b, b));
+		float32x4_t background = vaddq_f32(vaddq_f32(vmulq_f32(otherR, otherR), vmulq_f32(otherG, otherG)), vmulq_f32(otherB, otherB));
+		float32x4_t score = vaddq_f32(vmulq_f32(foreground, vld1q_f32(&table->foregroundWeights[mask])), vmulq_f32(background, vld1q_f32(&table->backgroundWeights[mask])));
+		uint32x4_t better = vcgtq_f32(score, bestScores);
+		bestScores = vbslq_f32(better, score, bestScores);
+		bestMasks = vbslq_u32(better, masks, bestMasks);
+		masks = vaddq_u32(masks, vdupq_n_u32(4));
+	}
+	float scores[4];
+	uint32_t lanes[4];
+	vst1q_f32(scores, bestScores);
+	vst1q_u32(lanes, bestMasks);
+	return pickBlockSplit(scores, lanes);
+}
+#endif
+
+static blockSplitFunc blockSplitKernel = bestBlockSplit;
+
+// base64 for the graphics protocols, whole 3 byte groups go through a kernel and the padded end is done separately.
+// the kernels return how many bytes they got through so each one can hand what's left to the next one down
+typedef size_t (*base64Func)(char* out, const unsigned char* data, size_t size);
+
+static const char base64Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static size_t base64Scalar(char* out, const unsigned char* data, size_t size) {
+	size_t i = 0;
+	for(; i + 3 <= size; i += 3) {
+		uint32_t bits = (uint32_t)data[i] << 16 | (uint32_t)data[i + 1] << 8 | data[i + 2];
+		*out++ = base64Digits[bits >> 18];
+		*out++ = base64Digits[(bits >> 12) & 63];
+		*out++ = base64Digits[(bits >> 6) & 63];
+		*out++ = base64Digits[bits & 63];
+	}
+	return i;
+}
+
+#if defined(__SSE2__)
+// sse2 can't shuffle bytes around so there's no point below avx2. each 3 bytes get spread over 4 and the 6 bit pieces
+// are moved into place with multiplies (http://0x80.pl/notesen/2016-01-12-sse-base64-encoding.html), then the digits
+// come from adding an offset picked out of a table by which range the piece is in
+__attribute__((target("avx2")))
+static size_t base64AVX2(char* out, const unsigned char* data, size_t size) {
+	const __m256i spread = _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i offsets = _mm256_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	size_t i = 0;
+	// the second load goes 4 bytes past the 24 that get used
+	for(; i + 28 <= size; i += 24) {
+		__m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)&data[i])), _mm_loadu_si128((const __m128i*)&data[i + 12]), 1);
+		in = _mm256_shuffle_epi8(in, spread);
+		__m256i high = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+		__m256i low = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+		__m256i pieces = _mm256_or_si256(high, low);
+		// 0 for a-z, 1 to 10 for digits, 11 and 12 for + and /, then 13 for A-Z
+		__m256i range = _mm256_subs_epu8(pieces, _mm256_set1_epi8(51));
+		range = _mm256_or_si256(range, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), pieces), _mm256_set1_epi8(13)));
+		__m256i digits = _mm256_add_epi8(pieces, _mm256_shuffle_epi8(offsets, range));
+		_mm256_storeu_si256((__m256i*)&out[i / 3 * 4], digits);
+	}
+	return i + base64Scalar(&out[i / 3 * 4], &data[i], size - i);
+}
+#elif defined(__ARM_NEON)
+// same offsets as the avx2 version, just picked with compares since 32 bit arm doesn't have the table lookup
+static inline uint8x16_t base64DigitsNEON(uint8x16_t pieces) {
+	uint8x16_t offset = vdupq_n_u8('A');
+	offset = vaddq_u8(offset, vandq_u8(vcgtq_u8(pieces, vdupq_n_u8(25)), vdupq_n_u8('a' - 26 - 'A')));
+	offset = vaddq_u8(offset, vandq_u8(vcgtq_u8(pieces, vdupq_n_u8(51)), vdupq_n_u8((uint8_t)('0' - 52 - ('a' - 26)))));
+	offset = vaddq_u8(offset, vandq_u8(vcgtq_u8(pieces, vdupq_n_u8(61)), vdupq_n_u8((uint8_t)('+' - 62 - ('0' - 52)))));
+	offset = vaddq_u8(offset, vandq_u8(vcgtq_u8(pieces, vdupq_n_u8(62)), vdupq_n_u8((uint8_t)('/' - 63 - ('+' - 62)))));
+	return vaddq_u8(pieces, offset);
+}
+
+// the loads and stores do the (de)interleaving, 48 bytes in and 64 digits out
+static size_t base64NEON(char* out, const unsigned char* data, size_t size) {
+	const uint8x16_t mask = vdupq_n_u8(63);
+	size_t i = 0;
+	for(; i + 48 <= size; i += 48) {
+		uint8x16x3_t in = vld3q_u8(&data[i]);
+		uint8x16x4_t pieces;
+		pieces.val[0] = vshrq_n_u8(in.val[0], 2);
+		pieces.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), mask);
+		pieces.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), mask);
+		pieces.val[3] = vandq_u8(in.val[2], mask);
+		for(unsigned int c = 0; c < 4; ++c) {
+			pieces.val[c] = base64DigitsNEON(pieces.val[c]);
+		}
+		vst4q_u8((uint8_t*)&out[i / 3 * 4], pieces);
+	}
+	return i + base64Scalar(&out[i / 3 * 4], &data[i], size - i);
+}
+#endif
+
+static base64Func base64Kernel = base64Scalar;
+
+// needs ((size + 2) / 3) * 4 bytes reserved
+static void appendBase64(frameBuffer* frame, const unsigned char* data, size_t size) {
+	size_t i = base64Kernel(frame->data + frame->size, data, size);
+	char* out = frame->data + frame->size + i / 3 * 4;
+	if(i < size) {
+		uint32_t bits = (uint32_t)data[i] << 16 | (i + 1 < size ? (uint32_t)data[i + 1] << 8 : 0);
+		*out++ = base64Digits[bits >> 18];
+		*out++ = base64Digits[(bits >> 12) & 63];
+		*out++ = i + 1 < size ? base64Digits[(bits >> 6) & 63] : '=';
+		*out++ = '=';
+	}
+	frame->size = out - frame->data;
+}
+
+// picks the fastest version of each kernel that the cpu running this can do
+// sse2 is always there on x86_64 so only avx2 needs checking at runtime
+void initKernels() {
+#if defined(__SSE2__)
+	shrinkRowKernel = shrinkRowSSE2;
+	accumulateRowKernel = accumulateRowSSE2;
+	quantizeRowKernel = quantizeRowSSE2;
+	quantizeRowWithLUTKernel = quantizeRowWithLUTSSE2;
+	blockSplitKernel = bestBlockSplitSSE2;
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		accumulateRowKernel = accumulateRowAVX2;
+		quantizeRowKernel = quantizeRowAVX2;
+		quantizeRowWithLUTKernel = quantizeRowWithLUTAVX2;
+		base64Kernel = base64AVX2;
+	}
+#elif defined(__ARM_NEON)
+	shrinkRowKernel = shrinkRowNEON;
+	accumulateRowKernel = accumulateRowNEON;
+	quantizeRowKernel = quantizeRowNEON;
+	quantizeRowWithLUTKernel = quantizeRowWithLUTNEON;
+	blockSplitKernel = bestBlockSplitNEON;
+	base64Kernel = base64NEON;
+#endif
+}
+
+// moves the cursor right without having to know which row it's on, shorter than a full move for small gaps
+static inline void appendCursorForward(frameBuffer* frame, unsigned int n) {
+	frameAppendLiteral(frame, "\033[");
+	frameAppendUInt(frame, n);
+	frameAppendLiteral(frame, "C");
+}
+
+// when there's a previous frame the cells that haven't changed since then get skipped over instead of written again
+// returns false for cells that should be skipped, and takes care of getting the cursor to the cell otherwise
+static inline bool appendCellPosition(frameBuffer* frame, unsigned int x, unsigned int y, bool changed, bool* started, unsigned int* skipped) {
+	if(!changed) {
+		++*skipped;
+		return false;
+	}
+	if(!*started) {
+		// cursor positions start at 1
+		appendCursorMove(frame, x + 1, y + 1);
+		*started = true;
+	} else if(*skipped > 0) {
+		appendCursorForward(frame, *skipped);
+	}
+	*skipped = 0;
+	return true;
+}
+
+// writes a row left to right with only one cursor move at the start (unless there are unchanged cells to skip)
+// the color escape is skipped when a cell is the same color as the one before it since the terminal keeps it around anyway
+// left is the column the row starts at, everything here is drawn at an absolute position. false if the frame couldn't grow
+bool appendRow(frameBuffer* frame, unsigned int left, unsigned int y, const cellColor* colors, const cellColor* previous, unsigned int w, cellColor* lastColor) {
+	if(!frameReserve(frame, (size_t)w * FRAME_MAX_CELL_BYTES + FRAME_MAX_CELL_BYTES)) {
+		return false;
+	}
+	bool started = false;
+	unsigned int skipped = 0;
+	for(unsigned int x = 0; x < w; ++x) {
+		if(!appendCellPosition(frame, left + x, y, !previous || colors[x] != previous[x], &started, &skipped)) {
+			continue;
+		}
+		if(colors[x] != *lastColor) {
+			appendBackgroundColor(frame, colors[x]);
+			*lastColor = colors[x];
+		}
+		frameAppendLiteral(frame, " ");
+	}
+	return true;
+}
+
+static inline void appendCodepoint(frameBuffer* frame, uint32_t c) {
+	if(c < 0x80) {
+		frame->data[frame->size++] = c;
+	} else if(c < 0x800) {
+		frame->data[frame->size++] = 0xc0 | (c >> 6);
+		frame->data[frame->size++] = 0x80 | (c & 0x3f);
+	} else if(c < 0x10000) {
+		frame->data[frame->size++] = 0xe0 | (c >> 12);
+		frame->data[frame->size++] = 0x80 | ((c >> 6) & 0x3f);
+		frame->data[frame->size++] = 0x80 | (c & 0x3f);
+	} else {
+		frame->data[frame->size++] = 0xf0 | (c >> 18);
+		frame->data[frame->size++] = 0x80 | ((c >> 12) & 0x3f);
+		frame->data[frame->size++] = 0x80 | ((c >> 6) & 0x3f);
+		frame->data[frame->size++] = 0x80 | (c & 0x3f);
+	}
+}
+
+// shows the pixels in mask with the foreground color and the rest with the background using a block character,
+// so for half blocks a mask of 1 is the top one as the foreground and the bottom one as the background
+static inline void appendBlockCell(frameBuffer* frame, blockModeEnum blocks, unsigned int mask, cellColor foreground, cellColor background, cellColor* lastForeground, cellColor* lastBackground) {
+	unsigned int full = (1u << (blockColumns[blocks] * blockRows[blocks])) - 1;
+	if(foreground == background || mask == 0 || mask == full) {
+		cellColor color = mask == full ? foreground : background;
+		// one color for the whole cell, whichever of a space or a full block doesn't need a new escape
+		if(color != CELL_COLOR_DEFAULT && *lastForeground == color && *lastBackground != color) {
+			frameAppendLiteral(frame, "\u2588");
+			return;
+		}
+		if(*lastBackground != color) {
+			if(color == CELL_COLOR_DEFAULT) {
+				frameAppendLiteral(frame, "\033[49m");
+			} else {
+				appendBackgroundColor(frame, color);
+			}
+			*lastBackground = color;
+		}
+		frameAppendLiteral(frame, " ");
+		return;
+	}
+	
+	bool swap;
+	if(foreground == CELL_COLOR_DEFAULT) {
+		// transparent can only be the background so flip it to the other block
+		swap = true;
+	} else if(background == CELL_COLOR_DEFAULT) {
+		swap = false;
+	} else {
+		// either way works so go with whichever one changes fewer colors
+		unsigned int changes = (*lastForeground != foreground) + (*lastBackground != background);
+		unsigned int swappedChanges = (*lastForeground != background) + (*lastBackground != foreground);
+		swap = swappedChanges < changes;
+	}
+	if(swap) {
+		cellColor other = foreground;
+		foreground = background;
+		background = other;
+		mask ^= full;
+	}
+	
+	if(*lastForeground != foreground) {
+		appendForegroundColor(frame, foreground);
+		*lastForeground = foreground;
+	}
+	if(*lastBackground != background) {
+		if(background == CELL_COLOR_DEFAULT) {
+			frameAppendLiteral(frame, "\033[49m");
+		} else {
+			appendBackgroundColor(frame, background);
+		}
+		*lastBackground = background;
+	}
+	appendCodepoint(frame, blockGlyph(blocks, mask));
+}
+
+// same as appendRow but for half blocks, previousTop and previousBottom are either both there or both NULL
+bool appendHalfBlockRow(frameBuffer* frame, unsigned int left, unsigned int y, const cellColor* top, const cellColor* bottom, const cellColor* previousTop, const cellColor* previousBottom, unsigned int w, cellColor* lastForeground, cellColor* lastBackground) {
+	if(!frameReserve(frame, (size_t)w * FRAME_MAX_CELL_BYTES + FRAME_MAX_CELL_BYTES)) {
+		return false;
+	}
+	bool started = false;
+	unsigned int skipped = 0;
+	for(unsigned int x = 0; x < w; ++x) {
+		bool changed = !previousTop || top[x] != previousTop[x] || bottom[x] != previousBottom[x];
+		if(appendCellPosition(frame, left + x, y, changed, &started, &skipped)) {
+			appendBlockCell(frame, BLOCKS_HALF, 1, top[x], bottom[x], lastForeground, lastBackground);
+		}
+	}
+	return true;
+}
+
+// the average of the pixels in mask, transparent if there aren't any
+static terminalColor averageBlockPixels(const terminalColor* pixels, unsigned int count, unsigned int mask) {
+	unsigned int sums[3] = {0, 0, 0};
+	unsigned int n = 0;
+	for(unsigned int i = 0; i < count; ++i) {
+		if(mask & (1u << i)) {
+			sums[0] += pixels[i].r;
+			sums[1] += pixels[i].g;
+			sums[2] += pixels[i].b;
+			++n;
+		}
+	}
+	terminalColor color = {0, 0, 0, 0};
+	if(n > 0) {
+		color.r = (sums[0] + n / 2) / n;
+		color.g = (sums[1] + n / 2) / n;
+		color.b = (sums[2] + n / 2) / n;
+		color.a = 0xff;
+	}
+	return color;
+}
+
+// picks the block and the two colors for the cell at x, y. transparent pixels can only show the background, so when
+// there are any the rest all get the foreground
+static unsigned int fitBlockCell(const blockSplitTable* table, const terminalColor* image, unsigned int imageWidth, unsigned int x, unsigned int y, terminalColor* foreground, terminalColor* background) {
+	terminalColor pixels[BLOCK_MAX_PIXELS];
+	unsigned int count = table->pixels;
+	unsigned int opaque = 0;
+	bool flat = true;
+	for(unsigned int i = 0; i < count; ++i) {
+		terminalColor c = image[(size_t)(y * (count / 2) + i / 2) * imageWidth + x * 2 + i % 2];
+		pixels[i] = c;
+		if(c.a >= ALPHA_CUTOFF) {
+			opaque |= 1u << i;
+		}
+		flat = flat && c.r == pixels[0].r && c.g == pixels[0].g && c.b == pixels[0].b;
+	}
+	
+	unsigned int all = (1u << count) - 1;
+	unsigned int mask = 0;
+	if(opaque != all) {
+		mask = opaque;
+	} else if(!flat) {
+		float values[BLOCK_MAX_PIXELS * 3];
+		for(unsigned int i = 0; i < count; ++i) {
+			values[i * 3] = pixels[i].r;
+			values[i * 3 + 1] = pixels[i].g;
+			values[i * 3 + 2] = pixels[i].b;
+		}
+		mask = blockSplitKernel(table, values);
+	}
+	*foreground = averageBlockPixels(pixels, count, mask);
+	*background = opaque == all ? averageBlockPixels(pixels, count, mask ^ all) : (terminalColor){0, 0, 0, 0};
+	return mask;
+}
+
+// somewhere for a band to keep a row of cells between fitting them and writing them out
+typedef struct {
+	terminalColor* foregrounds;
+	terminalColor* backgrounds;
+	cellColor* foregroundCells;
+	cellColor* backgroundCells;
+	uint8_t* masks;
+} blockRowScratch;
+
+// cells gets the color every pixel actually ends up showing, which is what tells if a cell looks any different from
+// the last frame
+bool appendFittedBlockRow(frameBuffer* frame, blockModeEnum blocks, const blockSplitTable* table, const terminalColor* image, unsigned int w, unsigned int left, unsigned int top, unsigned int y, quantizeRowFunc quantize, const paletteCube* cube, cellColor* cells, const cellColor* previous, blockRowScratch* scratch, cellColor* lastForeground, cellColor* lastBackground) {
+	unsigned int imageWidth = w * 2;
+	unsigned int rows = blockRows[blocks];
+	for(unsigned int x = 0; x < w; ++x) {
+		scratch->masks[x] = fitBlockCell(table, image, imageWidth, x, y, &scratch->foregrounds[x], &scratch->backgrounds[x]);
+	}
+	quantize(scratch->foregroundCells, scratch->foregrounds, w, cube);
+	quantize(scratch->backgroundCells, scratch->backgrounds, w, cube);
+	
+	if(!frameReserve(frame, (size_t)w * FRAME_MAX_CELL_BYTES + FRAME_MAX_CELL_BYTES)) {
+		return false;
+	}
+	bool started = false;
+	unsigned int skipped = 0;
+	for(unsigned int x = 0; x < w; ++x) {
+		cellColor foreground = scratch->foregroundCells[x];
+		cellColor background = scratch->backgroundCells[x];
+		bool changed = !previous;
+		for(unsigned int i = 0; i < table->pixels; ++i) {
+			size_t spot = (size_t)(y * rows + i / 2) * imageWidth + x * 2 + i % 2;
+			cells[spot] = scratch->masks[x] & (1u << i) ? foreground : background;
+			changed = changed || cells[spot] != previous[spot];
+		}
+		if(appendCellPosition(frame, left + x, top + y, changed, &started, &skipped)) {
+			appendBlockCell(frame, blocks, scratch->masks[x], foreground, background, lastForeground, lastBackground);
+		}
+	}
+	return true;
+}
+
+// the grid gets split into bands of rows that get quantized and written out into their own buffers on the worker pool,
+// then they're copied into the frame in order. each band starts with a color escape since it can't know what came before
+typedef struct {
+	const terminalColor* image;
+	// in cells
+	unsigned int w, h;
+	// where the top left cell goes on screen
+	unsigned int left, top;
+	unsigned int bandSize;
+	quantizeRowFunc quantize;
+	const paletteCube* cube;
+	// the image is blockColumns by blockRows pixels for every cell
+	blockModeEnum blocks;
+	const blockSplitTable* splits;
+	cellColor* cells;
+	const cellColor* previous;
+	frameBuffer* bands;
+} frameRenderJob;
+
+static void renderFrameBand(void* ctx, unsigned int index) {
+	frameRenderJob* job = ctx;
+	unsigned int first = index * job->bandSize;
+	unsigned int end = first + job->bandSize < job->h ? first + job->bandSize : job->h;
+	frameBuffer* band = &job->bands[index];
+	
+	if(!frameInit(band, (size_t)(end - first) * ((size_t)job->w * FRAME_MAX_CELL_BYTES + FRAME_MAX_CELL_BYTES))) {
+		return;
+	}
+	
+	cellColor lastColor = CELL_COLOR_UNKNOWN;
+	cellColor lastForeground = CELL_COLOR_UNKNOWN;
+	if(job->splits) {
+		blockRowScratch scratch = {
+			.foregrounds = arenaMalloc(sizeof(terminalColor) * job->w),
+			.backgrounds = arenaMalloc(sizeof(terminalColor) * job->w),
+			.foregroundCells = arenaMalloc(sizeof(cellColor) * job->w),
+			.backgroundCells = arenaMalloc(sizeof(cellColor) * job->w),
+			.masks = arenaMalloc(job->w),
+		};
+		bool succeeded = scratch.foregrounds && scratch.backgrounds && scratch.foregroundCells && scratch.backgroundCells && scratch.masks;
+		for(unsigned int y = first; succeeded && y < end; ++y) {
+			succeeded = appendFittedBlockRow(band, job->blocks, job->splits, job->image, job->w, job->left, job->top, y, job->quantize, job->cube, job->cells, job->previous, &scratch, &lastForeground, &lastColor);
+		}
+		// a band without data is how renderFrame finds out it failed
+		if(!succeeded) {
+			frameFree(band);
+		}
+		arenaFree(scratch.masks);
+		arenaFree(scratch.backgroundCells);
+		arenaFree(scratch.foregroundCells);
+		arenaFree(scratch.backgrounds);
+		arenaFree(scratch.foregrounds);
+		return;
+	}
+	
+	unsigned int rowsPerCell = blockRows[job->blocks];
+	for(unsigned int imgY = first * rowsPerCell; imgY < end * rowsPerCell; ++imgY) {
+		job->quantize(&job->cells[(size_t)imgY * job->w], &job->image[(size_t)imgY * job->w], job->w, job->cube);
+	}
+	
+	for(unsigned int y = first; y < end; ++y) {
+		size_t offset = (size_t)y * rowsPerCell * job->w;
+		const cellColor* previous = job->previous ? &job->previous[offset] : NULL;
+		bool appended;
+		if(job->blocks == BLOCKS_HALF) {
+			appended = appendHalfBlockRow(band, job->left, job->top + y, &job->cells[offset], &job->cells[offset + job->w], previous, previous ? previous + job->w : NULL, job->w, &lastForeground, &lastColor);
+		} else {
+			appended = appendRow(band, job->left, job->top + y, &job->cells[offset], previous, job->w, &lastColor);
+		}
+		if(!appended) {
+			frameFree(band);
+			return;
+		}
+	}
+}
+
+// w and h are in cells, the image needs to be blockColumns and blockRows times that. left and top are the cell it
+// starts at, 0 based. cells gets the quantized colors of every pixel in the image, if previous has the ones from the
+// last frame then only the cells that changed get written
+bool renderFrame(frameBuffer* frame, const terminalColor* image, unsigned int w, unsigned int h, unsigned int left, unsigned int top, blockModeEnum blocks, quantizeRowFunc quantize, const paletteCube* cube, cellColor* cells, const cellColor* previous, workerPool* pool) {
+	if(h == 0) {
+		return true;
+	}
+	unsigned int bandCount = workerPoolBandCount(pool, h);
+	frameRenderJob job = {
+		.image = image,
+		.w = w,
+		.h = h,
+		.left = left,
+		.top = top,
+		.bandSize = (h + bandCount - 1) / bandCount,
+		.quantize = quantize,
+		.cube = cube,
+		.blocks = blocks,
+		.cells = cells,
+		.previous = previous,
+	};
+	blockSplitTable splits;
+	if(blockColumns[blocks] == 2) {
+		initBlockSplitTable(&splits, blockColumns[blocks] * blockRows[blocks]);
+		job.splits = &splits;
+	}
+	bandCount = (h + job.bandSize - 1) / job.bandSize;
+	job.bands = arenaCalloc(bandCount, sizeof(frameBuffer));
+	if(!job.bands) {
+		return false;
+	}
+	
+	workerPoolRun(pool, renderFrameBand, &job, bandCount);
+	
+	bool succeeded = true;
+	size_t total = 0;
+	for(unsigned int i = 0; i < bandCount; ++i) {
+		if(!job.bands[i].data) {
+			succeeded = false;
+		}
+		total += job.bands[i].size;
+	}
+	if(succeeded && frameReserve(frame, total)) {
+		for(unsigned int i = 0; i < bandCount; ++i) {
+			frameAppendBytes(frame, job.bands[i].data, job.bands[i].size);
+		}
+	} else {
+		succeeded = false;
+	}
+	
+	for(unsigned int i = 0; i < bandCount; ++i) {
+		frameFree(&job.bands[i]);
+	}
+	arenaFree(job.bands);
+	return succeeded;
+}
+
+// moves to the bottom since it messes up when displaying transparent images for some reason
+static bool appendFrameEnd(frameBuffer* frame, unsigned int h) {
+	if(!frameReserve(frame, FRAME_MAX_CELL_BYTES)) {
+		return false;
+	}
+	frameAppendLiteral(frame, "\033[H\033[");
+	frameAppendUInt(frame, h);
+	frameAppendLiteral(frame, "B\033[0m\n");
+	return true;
+}
+
+// sixel draws actual pixels instead of cells, six rows at a time. the palette gets picked for each image with median cut
+// over a histogram of its colors at the palette cube's precision, and every spot in the cube gets pointed at the box it
+// ended up in, so finding a pixel's color is the same lookup 256 color mode does
+#define SIXEL_MAX_COLORS 255
+// never a palette entry, these pixels are left showing the terminal background
+#define SIXEL_TRANSPARENT 255
+#define SIXEL_BAND_ROWS 6
+// only every other pixel in each direction goes into the histogram, that's still plenty to find the main colors
+#define SIXEL_HISTOGRAM_STEP 2
+// longest a single run of one sixel can take, "!65535" plus the sixel
+#define SIXEL_MAX_RUN_BYTES 7
+
+typedef struct {
+	terminalColor colors[SIXEL_MAX_COLORS];
+	unsigned int count;
+	paletteCube cube;
+} sixelPalette;
+
+typedef struct {
+	// the part of the cube this box covers, every spot in the cube is in exactly one box
+	uint8_t low[3], high[3];
+	// the part of that which actually has colors in it, which is what gets split
+	uint8_t usedLow[3], usedHigh[3];
+	uint32_t count;
+} sixelBox;
+
+typedef struct {
+	uint32_t counts[PALETTE_CUBE_SIZE * PALETTE_CUBE_SIZE * PALETTE_CUBE_SIZE];
+	// the real colors that landed in each spot added up, so the palette isn't stuck at 5 bits a channel
+	uint32_t sums[PALETTE_CUBE_SIZE * PALETTE_CUBE_SIZE * PALETTE_CUBE_SIZE][3];
+} sixelHistogram;
+
+#define forEachBoxSpot(box, r, g, b) \
+	for(unsigned int r = (box)->low[0]; r <= (box)->high[0]; ++r) \
+		for(unsigned int g = (box)->low[1]; g <= (box)->high[1]; ++g) \
+			for(unsigned int b = (box)->low[2]; b <= (box)->high[2]; ++b)
+
+static void measureSixelBox(sixelBox* box, const sixelHistogram* histogram) {
+	box->count = 0;
+	for(unsigned int c = 0; c < 3; ++c) {
+		box->usedLow[c] = PALETTE_CUBE_SIZE - 1;
+		box->usedHigh[c] = 0;
+	}
+	forEachBoxSpot(box, r, g, b) {
+		uint32_t count = histogram->counts[paletteCubeIndex(r, g, b)];
+		if(count == 0) {
+			continue;
+		}
+		box->count += count;
+		unsigned int spot[3] = {r, g, b};
+		for(unsigned int c = 0; c < 3; ++c) {
+			if(spot[c] < box->usedLow[c]) { box->usedLow[c] = spot[c]; }
+			if(spot[c] > box->usedHigh[c]) { box->usedHigh[c] = spot[c]; }
+		}
+	}
+}
+
+// the channel the colors in the box are most spread out along, or -1 if they're all in one spot
+static int sixelSplitChannel(const sixelBox* box) {
+	int channel = -1;
+	int widest = 0;
+	for(int c = 0; c < 3; ++c) {
+		int width = box->usedHigh[c] - box->usedLow[c];
+		if(box->count > 0 && width > widest) {
+			widest = width;
+			channel = c;
+		}
+	}
+	return channel;
+}
+
+bool buildSixelPalette(sixelPalette* palette, const terminalColor* image, unsigned int w, unsigned int h) {
+	sixelHistogram* histogram = arenaCalloc(1, sizeof(sixelHistogram));
+	sixelBox* boxes = arenaMalloc(sizeof(sixelBox) * SIXEL_MAX_COLORS);
+	if(!histogram || !boxes) {
+		arenaFree(boxes);
+		arenaFree(histogram);
+		return false;
+	}
+	
+	const unsigned int shift = 8 - PALETTE_CUBE_BITS;
+	for(unsigned int y = 0; y < h; y += SIXEL_HISTOGRAM_STEP) {
+		const terminalColor* row = &image[(size_t)y * w];
+		for(unsigned int x = 0; x < w; x += SIXEL_HISTOGRAM_STEP) {
+			terminalColor c = row[x];
+			if(c.a < ALPHA_CUTOFF) {
+				continue;
+			}
+			unsigned int spot = paletteCubeIndex(c.r >> shift, c.g >> shift, c.b >> shift);
+			++histogram->counts[spot];
+			histogram->sums[spot][0] += c.r;
+			histogram->sums[spot][1] += c.g;
+			histogram->sums[spot][2] += c.b;
+		}
+	}
+	
+	sixelBox* first = &boxes[0];
+	for(unsigned int c = 0; c < 3; ++c) {
+		first->low[c] = 0;
+		first->high[c] = PALETTE_CUBE_SIZE - 1;
+	}
+	measureSixelBox(first, histogram);
+	unsigned int boxCount = 1;
+	
+	while(boxCount < SIXEL_MAX_COLORS) {
+		// the box with the most pixels spread out the furthest gets split in two at its median
+		sixelBox* box = NULL;
+		uint64_t bestScore = 0;
+		for(unsigned int i = 0; i < boxCount; ++i) {
+			int channel = sixelSplitChannel(&boxes[i]);
+			if(channel < 0) {
+				continue;
+			}
+			uint64_t score = (uint64_t)boxes[i].count * (boxes[i].usedHigh[channel] - boxes[i].usedLow[channel]);
+			if(score > bestScore) {
+				bestScore = score;
+				box = &boxes[i];
+			}
+		}
+		if(!box) {
+			break;
+		}
+		
+		int channel = sixelSplitChannel(box);
+		uint32_t slices[PALETTE_CUBE_SIZE] = {0};
+		forEachBoxSpot(box, r, g, b) {
+			unsigned int spot[3] = {r, g, b};
+			slices[spot[channel]] += histogram->counts[paletteCubeIndex(r, g, b)];
+		}
+		// both halves have to end up with something in them
+		unsigned int split = box->usedLow[channel];
+		uint32_t below = slices[split];
+		while(split + 1 < box->usedHigh[channel] && below * 2 < box->count) {
+			below += slices[++split];
+		}
+		
+		sixelBox* other = &boxes[boxCount++];
+		*other = *box;
+		box->high[channel] = split;
+		other->low[channel] = split + 1;
+		measureSixelBox(box, histogram);
+		measureSixelBox(other, histogram);
+	}
+	
+	for(unsigned int i = 0; i < boxCount; ++i) {
+		const sixelBox* box = &boxes[i];
+		uint64_t sums[3] = {0, 0, 0};
+		forEachBoxSpot(box, r, g, b) {
+			unsigned int spot = paletteCubeIndex(r, g, b);
+			for(unsigned int c = 0; c < 3; ++c) {
+				sums[c] += histogram->sums[spot][c];
+			}
+			palette->cube.index[spot] = i;
+		}
+		terminalColor color = {0, 0, 0, 0xff};
+		if(box->count > 0) {
+			color.r = (sums[0] + box->count / 2) / box->count;
+			color.g = (sums[1] + box->count / 2) / box->count;
+			color.b = (sums[2] + box->count / 2) / box->count;
+		}
+		palette->colors[i] = color;
+	}
+	palette->count = boxCount;
+	
+	arenaFree(boxes);
+	arenaFree(histogram);
+	return true;
+}
+
+// runs of 4 or more are shorter with a repeat
+static inline void appendSixelRun(frameBuffer* frame, char sixel, unsigned int length) {
+	if(length > 3) {
+		frame->data[frame->size++] = '!';
+		frameAppendUInt(frame, length);
+		frame->data[frame->size++] = sixel;
+		return;
+	}
+	while(length-- > 0) {
+		frame->data[frame->size++] = sixel;
+	}
+}
+
+typedef struct {
+	const terminalColor* image;
+	unsigned int w, h;
+	const sixelPalette* palette;
+	unsigned int bandsPerJob;
+	// one per job, stitched together in order once they're all done
+	frameBuffer* jobs;
+} sixelRenderJob;
+
+// every color in a band gets its own pass over the band, only covering the columns it shows up in
+static void renderSixelBands(void* ctx, unsigned int index) {
+	sixelRenderJob* job = ctx;
+	frameBuffer* out = &job->jobs[index];
+	unsigned int w = job->w;
+	unsigned int bandCount = (job->h + SIXEL_BAND_ROWS - 1) / SIXEL_BAND_ROWS;
+	unsigned int first = index * job->bandsPerJob;
+	unsigned int end = first + job->bandsPerJob < bandCount ? first + job->bandsPerJob : bandCount;
+	
+	// which rows of the band each color is in, for every column
+	uint8_t* masks = arenaCalloc((size_t)w * SIXEL_MAX_COLORS, 1);
+	uint8_t* indices = arenaMalloc((size_t)w * SIXEL_BAND_ROWS);
+	if(!masks || !indices || !frameInit(out, FRAME_MAX_CELL_BYTES)) {
+		arenaFree(indices);
+		arenaFree(masks);
+		return;
+	}
+	
+	const unsigned int shift = 8 - PALETTE_CUBE_BITS;
+	unsigned int firstX[SIXEL_MAX_COLORS];
+	unsigned int lastX[SIXEL_MAX_COLORS];
+	uint8_t used[SIXEL_MAX_COLORS];
+	bool seen[SIXEL_MAX_COLORS] = {false};
+	for(unsigned int band = first; band < end; ++band) {
+		unsigned int top = band * SIXEL_BAND_ROWS;
+		unsigned int rows = job->h - top < SIXEL_BAND_ROWS ? job->h - top : SIXEL_BAND_ROWS;
+		for(unsigned int y = 0; y < rows; ++y) {
+			const terminalColor* row = &job->image[(size_t)(top + y) * w];
+			uint8_t* rowIndices = &indices[(size_t)y * w];
+			for(unsigned int x = 0; x < w; ++x) {
+				terminalColor c = row[x];
+				rowIndices[x] = c.a < ALPHA_CUTOFF ? SIXEL_TRANSPARENT : job->palette->cube.index[paletteCubeIndex(c.r >> shift, c.g >> shift, c.b >> shift)];
+			}
+		}
+		
+		unsigned int usedCount = 0;
+		for(unsigned int y = 0; y < rows; ++y) {
+			const uint8_t* rowIndices = &indices[(size_t)y * w];
+			for(unsigned int x = 0; x < w; ++x) {
+				unsigned int color = rowIndices[x];
+				if(color == SIXEL_TRANSPARENT) {
+					continue;
+				}
+				if(!seen[color]) {
+					seen[color] = true;
+					used[usedCount++] = color;
+					firstX[color] = x;
+					lastX[color] = x;
+				}
+				if(x < firstX[color]) { firstX[color] = x; }
+				if(x > lastX[color]) { lastX[color] = x; }
+				masks[(size_t)color * w + x] |= 1 << y;
+			}
+		}
+		
+		for(unsigned int i = 0; i < usedCount; ++i) {
+			unsigned int color = used[i];
+			uint8_t* mask = &masks[(size_t)color * w];
+			unsigned int x = firstX[color];
+			unsigned int last = lastX[color];
+			// the color number, the empty run up to the first column and the $ to go back to the start of the band
+			if(!frameReserve(out, 8 + SIXEL_MAX_RUN_BYTES + (size_t)(last - x + 1) * SIXEL_MAX_RUN_BYTES)) {
+				frameFree(out);
+				break;
+			}
+			out->data[out->size++] = '#';
+			frameAppendUInt(out, color);
+			appendSixelRun(out, '?', x);
+			while(x <= last) {
+				uint8_t bits = mask[x];
+				unsigned int length = 1;
+				while(x + length <= last && mask[x + length] == bits) {
+					++length;
+				}
+				appendSixelRun(out, '?' + bits, length);
+				x += length;
+			}
+			out->data[out->size++] = '$';
+			memset(&mask[firstX[color]], 0, last - firstX[color] + 1);
+			seen[color] = false;
+		}
+		if(!out->data) {
+			break;
+		}
+		
+		// - goes down to the next band so the $ after the last color isn't needed, and the last band doesn't need either
+		if(usedCount > 0) {
+			--out->size;
+		}
+		if(band + 1 < bandCount) {
+			// bands with nothing in them don't reserve anything above
+			if(!frameReserve(out, 1)) {
+				frameFree(out);
+				break;
+			}
+			out->data[out->size++] = '-';
+		}
+	}
+	
+	arenaFree(indices);
+	arenaFree(masks);
+}
+
+// draws image (w by h pixels) at the top left of the screen
+bool renderSixel(frameBuffer* frame, const terminalColor* image, unsigned int w, unsigned int h, workerPool* pool) {
+	sixelPalette* palette = arenaMalloc(sizeof(sixelPalette));
+	if(!palette || !buildSixelPalette(palette, image, w, h)) {
+		arenaFree(palette);
+		return false;
+	}
+	
+	// 1 in the second parameter leaves the pixels nothing gets drawn in showing the background, for transparency
+	if(!frameReserve(frame, FRAME_MAX_CELL_BYTES + (size_t)palette->count * 20)) {
+		arenaFree(palette);
+		return false;
+	}
+	frameAppendLiteral(frame, "\033[H\033P0;1;0q\"1;1;");
+	frameAppendUInt(frame, w);
+	frameAppendLiteral(frame, ";");
+	frameAppendUInt(frame, h);
+	// colors are given as percentages
+	for(unsigned int i = 0; i < palette->count; ++i) {
+		terminalColor c = palette->colors[i];
+		frameAppendLiteral(frame, "#");
+		frameAppendUInt(frame, i);
+		frameAppendLiteral(frame, ";2;");
+		frameAppendUInt(frame, (c.r * 100 + 127) / 255);
+		frameAppendLiteral(frame, ";");
+		frameAppendUInt(frame, (c.g * 100 + 127) / 255);
+		frameAppendLiteral(frame, ";");
+		frameAppendUInt(frame, (c.b * 100 + 127) / 255);
+	}
+	
+	unsigned int bandCount = (h + SIXEL_BAND_ROWS - 1) / SIXEL_BAND_ROWS;
+	unsigned int jobCount = workerPoolBandCount(pool, bandCount);
+	sixelRenderJob job = {
+		.image = image,
+		.w = w,
+		.h = h,
+		.palette = palette,
+		.bandsPerJob = jobCount ? (bandCount + jobCount - 1) / jobCount : 1,
+	};
+	jobCount = (bandCount + job.bandsPerJob - 1) / job.bandsPerJob;
+	job.jobs = arenaCalloc(jobCount ? jobCount : 1, sizeof(frameBuffer));
+	if(!job.jobs) {
+		arenaFree(palette);
+		return false;
+	}
+	
+	workerPoolRun(pool, renderSixelBands, &job, jobCount);
+	
+	bool succeeded = true;
+	size_t total = 0;
+	for(unsigned int i = 0; i < jobCount; ++i) {
+		if(!job.jobs[i].data) {
+			succeeded = false;
+		}
+		total += job.jobs[i].size;
+	}
+	if(succeeded && frameReserve(frame, total + FRAME_MAX_CELL_BYTES)) {
+		for(unsigned int i = 0; i < jobCount; ++i) {
+			frameAppendBytes(frame, job.jobs[i].data, job.jobs[i].size);
+		}
+		frameAppendLiteral(frame, "\033\\");
+	} else {
+		succeeded = false;
+	}
+	
+	for(unsigned int i = 0; i < jobCount; ++i) {
+		frameFree(&job.jobs[i]);
+	}
+	arenaFree(job.jobs);
+	arenaFree(palette);
+	return succeeded;
+}
+
+// kitty takes the pixels as they are, either base64 encoded right in the escape codes or as the name of a file or
+// shared memory object it reads them from itself, which keeps a big image out of the tty entirely
+#define KITTY_CHUNK_BYTES 4096
+// how many bytes of data fit in a chunk once they're base64 encoded
+#define KITTY_CHUNK_DATA_BYTES (KITTY_CHUNK_BYTES / 4 * 3)
+
+typedef enum {
+	KITTY_DIRECT,
+	KITTY_FILE,
+	KITTY_SHARED_MEMORY,
+} kittyTransferEnum;
+
+// kitty only deletes files it's sent when they're in a temp directory and have tty-graphics-protocol in the name
+static bool writeKittyFile(char* path, size_t pathSize, const unsigned char* data, size_t size) {
+	snprintf(path, pathSize, "/tmp/imgview-tty-graphics-protocol-XXXXXX");
+	int fd = mkstemp(path);
+	if(fd < 0) {
+		return false;
+	}
+	bool written = writeAll(fd, (const char*)data, size);
+	close(fd);
+	if(!written) {
+		unlink(path);
+	}
+	return written;
+}
+
+// kitty unlinks the shared memory once it's read it, so it's left alone here after it's filled in. one left behind by
+// an earlier run with the same pid would still be there, so the name gets a random part and another try if it's taken
+#define KITTY_SHARED_MEMORY_TRIES 16
+
+static bool writeKittySharedMemory(char* name, size_t nameSize, const unsigned char* data, size_t size) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint32_t random = (uint32_t)now.tv_nsec ^ (uint32_t)now.tv_sec * 0x9e3779b9u;
+	int fd = -1;
+	for(unsigned int i = 0; i < KITTY_SHARED_MEMORY_TRIES && fd < 0; ++i) {
+		// xorshift, just so each try is somewhere else
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		snprintf(name, nameSize, "/imgview-tty-graphics-protocol-%ld-%08x", (long)getpid(), (unsigned int)random);
+		fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+		if(fd < 0 && errno != EEXIST) {
+			return false;
+		}
+	}
+	if(fd < 0) {
+		return false;
+	}
+	void* memory = MAP_FAILED;
+	if(ftruncate(fd, size) == 0) {
+		memory = mmap(NULL, size, PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if(memory == MAP_FAILED) {
+		shm_unlink(name);
+		return false;
+	}
+	memcpy(memory, data, size);
+	munmap(memory, size);
+	return true;
+}
+
+// the control data's already in the frame, this adds the data or where to find it and ends the escape code
+static bool appendKittyData(frameBuffer* frame, const unsigned char* data, size_t size, kittyTransferEnum transfer) {
+	bool succeeded = true;
+	if(transfer == KITTY_DIRECT) {
+		// every chunk is its own escape code, m=1 on all but the last
+		size_t chunks = (size + KITTY_CHUNK_DATA_BYTES - 1) / KITTY_CHUNK_DATA_BYTES;
+		if(frameReserve(frame, (size + 2) / 3 * 4 + chunks * 16)) {
+			for(size_t offset = 0; offset < size; offset += KITTY_CHUNK_DATA_BYTES) {
+				size_t length = size - offset < KITTY_CHUNK_DATA_BYTES ? size - offset : KITTY_CHUNK_DATA_BYTES;
+				if(offset > 0) {
+					frameAppendLiteral(frame, "\033_G");
+				} else {
+					frameAppendLiteral(frame, ",");
+				}
+				if(offset + length < size) {
+					frameAppendLiteral(frame, "m=1;");
+				} else {
+					frameAppendLiteral(frame, "m=0;");
+				}
+				appendBase64(frame, data + offset, length);
+				frameAppendLiteral(frame, "\033\\");
+			}
+		} else {
+			succeeded = false;
+		}
+	} else {
+		// the payload is just where to find the data
+		char name[64];
+		if(!frameReserve(frame, FRAME_MAX_CELL_BYTES + sizeof(name) / 3 * 4 + 4)) {
+			return false;
+		}
+		if(transfer == KITTY_FILE) {
+			succeeded = writeKittyFile(name, sizeof(name), data, size);
+			frameAppendLiteral(frame, ",t=t,S=");
+		} else {
+			succeeded = writeKittySharedMemory(name, sizeof(name), data, size);
+			frameAppendLiteral(frame, ",t=s,S=");
+		}
+		frameAppendUInt(frame, size);
+		frameAppendLiteral(frame, ";");
+		if(succeeded) {
+			appendBase64(frame, (const unsigned char*)name, strlen(name));
+		}
+		frameAppendLiteral(frame, "\033\\");
+	}
+	
+	return succeeded;
+}
+
+// draws image (w by h pixels) at the top left of the screen stretched over columns by rows cells, so an image smaller
+// than the window goes over as it is and the terminal scales it up
+bool renderKitty(frameBuffer* frame, const terminalColor* image, unsigned int w, unsigned int h, unsigned int columns, unsigned int rows, kittyTransferEnum transfer) {
+	size_t count = (size_t)w * h;
+	bool opaque = true;
+	for(size_t i = 0; i < count; ++i) {
+		if(image[i].a != 0xff) {
+			opaque = false;
+			break;
+		}
+	}
+	// without any transparency it goes over as rgb, a quarter less to send
+	const unsigned char* pixels = (const unsigned char*)image;
+	unsigned char* packed = NULL;
+	size_t size = count * 4;
+	if(opaque) {
+		size = count * 3;
+		packed = arenaMalloc(size);
+		if(!packed) {
+			return false;
+		}
+		for(size_t i = 0; i < count; ++i) {
+			packed[i * 3] = image[i].r;
+			packed[i * 3 + 1] = image[i].g;
+			packed[i * 3 + 2] = image[i].b;
+		}
+		pixels = packed;
+	}
+	
+	// a=T shows it straight away, q=2 stops kitty answering on stdin and C=1 leaves the cursor where it was
+	if(!frameReserve(frame, FRAME_MAX_CELL_BYTES * 2)) {
+		arenaFree(packed);
+		return false;
+	}
+	frameAppendLiteral(frame, "\033[H\033_Ga=T,q=2,C=1,f=");
+	frameAppendUInt(frame, opaque ? 24 : 32);
+	frameAppendLiteral(frame, ",s=");
+	frameAppendUInt(frame, w);
+	frameAppendLiteral(frame, ",v=");
+	frameAppendUInt(frame, h);
+	frameAppendLiteral(frame, ",c=");
+	frameAppendUInt(frame, columns);
+	frameAppendLiteral(frame, ",r=");
+	frameAppendUInt(frame, rows);
+	
+	bool succeeded = appendKittyData(frame, pixels, size, transfer);
+	arenaFree(packed);
+	return succeeded;
+}
+
+// hands kitty a png file as it is (f=100), it works out the size itself and stretches it over the cells like anything
+// else. when it can open the file by name (t=f) it doesn't even need copying, and it leaves files sent that way alone
+bool renderKittyPNG(frameBuffer* frame, const inputFile* input, unsigned int columns, unsigned int rows, kittyTransferEnum transfer) {
+	char path[PATH_MAX];
+	bool byName = transfer == KITTY_FILE && input->named && realpath(input->path, path);
+	if(!frameReserve(frame, FRAME_MAX_CELL_BYTES * 2 + (byName ? (sizeof(path) + 2) / 3 * 4 : 0))) {
+		return false;
+	}
+	frameAppendLiteral(frame, "\033[H\033_Ga=T,q=2,C=1,f=100,c=");
+	frameAppendUInt(frame, columns);
+	frameAppendLiteral(frame, ",r=");
+	frameAppendUInt(frame, rows);
+	if(byName) {
+		frameAppendLiteral(frame, ",t=f;");
+		appendBase64(frame, (const unsigned char*)path, strlen(path));
+		frameAppendLiteral(frame, "\033\\");
+		return true;
+	}
+	return appendKittyData(frame, input->data, input->size, transfer);
+}
+
+// iterm2 (and the terminals that copied it) takes a whole image file in one escape code, with the width and height in
+// cells and the aspect ratio turned off it's stretched over them the same way everything else is
+bool renderITerm(frameBuffer* frame, const unsigned char* file, size_t size, unsigned int columns, unsigned int rows) {
+	if(!frameReserve(frame, FRAME_MAX_CELL_BYTES * 2 + (size + 2) / 3 * 4)) {
+		return false;
+	}
+	frameAppendLiteral(frame, "\033[H\033]1337;File=inline=1;size=");
+	frameAppendUInt(frame, size);
+	frameAppendLiteral(frame, ";width=");
+	frameAppendUInt(frame, columns);
+	frameAppendLiteral(frame, ";height=");
+	frameAppendUInt(frame, rows);
+	frameAppendLiteral(frame, ";preserveAspectRatio=0:");
+	appendBase64(frame, file, size);
+	frameAppendLiteral(frame, "\a");
+	return true;
+}
+
+// iterm2 only takes image files, so pixels that didn't come straight from one get put in a png. it's left uncompressed
+// since it's only going to the terminal, deflate would take longer than the extra bytes do
+#define PNG_STORED_BLOCK_BYTES 65535
+
+static uint32_t pngCRCTable[256];
+
+static uint32_t pngCRC(const unsigned char* data, size_t size) {
+	if(pngCRCTable[1] == 0) {
+		for(uint32_t n = 0; n < 256; ++n) {
+			uint32_t c = n;
+			for(unsigned int k = 0; k < 8; ++k) {
+				c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			}
+			pngCRCTable[n] = c;
+		}
+	}
+	uint32_t crc = 0xffffffff;
+	for(size_t i = 0; i < size; ++i) {
+		crc = pngCRCTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc ^ 0xffffffff;
+}
+
+static inline unsigned char* putBigEndian32(unsigned char* out, uint32_t value) {
+	out[0] = value >> 24;
+	out[1] = value >> 16;
+	out[2] = value >> 8;
+	out[3] = value;
+	return out + 4;
+}
+
+// length, type and crc go around data that's already been written after the first 8 bytes
+static unsigned char* finishPNGChunk(unsigned char* chunk, const char* type, size_t size) {
+	putBigEndian32(chunk, size);
+	memcpy(chunk + 4, type, 4);
+	return putBigEndian32(chunk + 8 + size, pngCRC(chunk + 4, size + 4));
+}
 
+// deflate's stored blocks just hold the bytes as they are
 typedef struct {
-	unsigned int r, g, b, a;
-} terminalColor;
+	unsigned char* out;
+	// in the current block and in the whole stream
+	size_t blockLeft, left;
+	uint32_t adlerLow, adlerHigh;
+} storedDeflate;
 
-bool loadPNGtoBuffer(const char* filePath, terminalColor* buffer, unsigned int w, unsigned int h) {
-	int imgWidth, imgHeight, channels;
-	
-	unsigned char* data = stbi_load(filePath, &imgWidth, &imgHeight, &channels, 4);
-	
-	if(!data) {
-		printf("Couldn't load image at location \"%s\"\n", filePath);
-		return false;
+// the most bytes that can go into the adler-32 sums before they have to be brought back down, same as zlib's
+#define ADLER_MAX_RUN 5552
+
+static void storedDeflateWrite(storedDeflate* deflate, const unsigned char* data, size_t size) {
+	while(size > 0) {
+		if(deflate->blockLeft == 0) {
+			size_t length = deflate->left < PNG_STORED_BLOCK_BYTES ? deflate->left : PNG_STORED_BLOCK_BYTES;
+			// a 1 here marks the last block, then the length and its complement
+			*deflate->out++ = length == deflate->left;
+			*deflate->out++ = length & 0xff;
+			*deflate->out++ = length >> 8;
+			*deflate->out++ = ~length & 0xff;
+			*deflate->out++ = (~length >> 8) & 0xff;
+			deflate->blockLeft = length;
+		}
+		size_t length = size < deflate->blockLeft ? size : deflate->blockLeft;
+		if(length > ADLER_MAX_RUN) {
+			length = ADLER_MAX_RUN;
+		}
+		memcpy(deflate->out, data, length);
+		for(size_t i = 0; i < length; ++i) {
+			deflate->adlerLow += data[i];
+			deflate->adlerHigh += deflate->adlerLow;
+		}
+		deflate->adlerLow %= 65521;
+		deflate->adlerHigh %= 65521;
+		deflate->out += length;
+		deflate->blockLeft -= length;
+		deflate->left -= length;
+		data += length;
+		size -= length;
+	}
+}
+
+unsigned char* encodeStoredPNG(const terminalColor* image, unsigned int w, unsigned int h, size_t* size) {
+	bool opaque = true;
+	for(size_t i = 0; i < (size_t)w * h; ++i) {
+		if(image[i].a != 0xff) {
+			opaque = false;
+			break;
+		}
+	}
+	unsigned int channels = opaque ? 3 : 4;
+	size_t rowBytes = 1 + (size_t)w * channels;
+	size_t raw = rowBytes * h;
+	size_t blocks = (raw + PNG_STORED_BLOCK_BYTES - 1) / PNG_STORED_BLOCK_BYTES;
+	size_t deflated = 2 + raw + blocks * 5 + 4;
+	if(deflated > UINT32_MAX) {
+		return NULL;
 	}
+	unsigned char* png = arenaMalloc(8 + 25 + 12 + deflated + 12);
+	unsigned char* row = arenaMalloc(rowBytes);
+	if(!png || !row) {
+		arenaFree(row);
+		arenaFree(png);
+		return NULL;
+	}
+	
+	unsigned char* out = png;
+	memcpy(out, "\x89PNG\r\n\x1a\n", 8);
+	out += 8;
+	unsigned char* chunk = out;
+	out = putBigEndian32(chunk + 8, w);
+	out = putBigEndian32(out, h);
+	// 8 bits, rgb or rgba, then the only compression and filtering there are and no interlacing
+	*out++ = 8;
+	*out++ = opaque ? 2 : 6;
+	*out++ = 0;
+	*out++ = 0;
+	*out++ = 0;
+	out = finishPNGChunk(chunk, "IHDR", 13);
 	
+	chunk = out;
+	out = chunk + 8;
+	// zlib's header for deflate with a 32k window
+	*out++ = 0x78;
+	*out++ = 0x01;
+	storedDeflate deflate = {
+		.out = out,
+		.left = raw,
+		.adlerLow = 1,
+	};
+	// every row starts with a filter type of 0, nothing
+	row[0] = 0;
 	for(unsigned int y = 0; y < h; ++y) {
+		const terminalColor* pixels = &image[(size_t)y * w];
+		unsigned char* bytes = row + 1;
 		for(unsigned int x = 0; x < w; ++x) {
-			// has to be float for some reason
-			unsigned int imgX = x * (imgWidth/(float)w);
-			unsigned int imgY = y * (imgHeight/(float)h);
-			unsigned int i = (imgY*imgWidth)+imgX;
-			terminalColor color = {
-				.r=data[i*4],
-				.g=data[i*4 + 1],
-				.b=data[i*4 + 2],
-				.a=data[i*4 + 3],
-			};
-			buffer[(y*w)+x] = color;
+			*bytes++ = pixels[x].r;
+			*bytes++ = pixels[x].g;
+			*bytes++ = pixels[x].b;
+			if(!opaque) {
+				*bytes++ = pixels[x].a;
+			}
 		}
+		storedDeflateWrite(&deflate, row, rowBytes);
 	}
+	out = putBigEndian32(deflate.out, deflate.adlerHigh << 16 | deflate.adlerLow);
+	out = finishPNGChunk(chunk, "IDAT", deflated);
 	
-	return true;
+	out = finishPNGChunk(out, "IEND", 0);
+	*size = out - png;
+	arenaFree(row);
+	return png;
 }
 
-// kinda dumb to have these unused parameters at the end but it's so that I don't get warnings when I assign the function pointer later
-// since I'm assigning the function pointer with either this or the LUT function to avoid having to check the color mode every time in the loop
-void printColorAtLocation(unsigned int x, unsigned int y, terminalColor c, UNUSED terminalColor* lut, UNUSED size_t lutSize) {
-	printf("\033[%i;%iH", y, x);
-	// arbitrary cutoff point
-	if(c.a < 250) {
-		// to make it show the actual terminal background
-		printf("\033[0m ");
-	} else {
-		printf("\033[48;2;%i;%i;%im ", c.r, c.g, c.b);
+// draws image (w by h pixels) at the top left of the screen stretched over columns by rows cells
+bool renderITermPixels(frameBuffer* frame, const terminalColor* image, unsigned int w, unsigned int h, unsigned int columns, unsigned int rows) {
+	size_t size;
+	unsigned char* png = encodeStoredPNG(image, w, h, &size);
+	if(!png) {
+		return false;
 	}
+	bool succeeded = renderITerm(frame, png, size, columns, rows);
+	arenaFree(png);
+	return succeeded;
 }
 
-// colors are based on the color scheme of my terminal (the default one that comes with kitty)
-// if you want it to have your color scheme you'd need to edit these yourself
-terminalColor colorLUT[256] = {
-	{0x00,0x00,0x00,0xff},  // black
-	{0xcd,0x00,0x00,0xff},  // red
-	{0x00,0xcd,0x00,0xff},  // green
-	{0xcd,0xcd,0x00,0xff},  // yellow
-	{0x00,0x00,0xee,0xff},  // blue
-	{0xcd,0x00,0xcd,0xff},  // magenta
-	{0x00,0xcd,0xcd,0xff},  // cyan
-	{0xe5,0xe5,0xe5,0xff},  // white
-	{0x7f,0x7f,0x7f,0xff},  // bright black
-	{0xff,0x00,0x00,0xff},  // bright red
-	{0x00,0xff,0x00,0xff},  // bright green
-	{0xff,0xff,0x00,0xff},  // bright yellow
-	{0x5c,0x5c,0xff,0xff},  // bright blue
-	{0xff,0x00,0xff,0xff},  // bright magenta
-	{0x00,0xff,0xff,0xff},  // bright cyan
-	{0xff,0xff,0xff,0xff},  // bright white
-};
+// everything about how to draw a frame that stays the same from one frame to the next
+typedef struct {
+	// in cells
+	unsigned int w, h;
+	blockModeEnum blocks;
+	resampleKernelEnum kernel;
+	quantizeRowFunc quantize;
+	const paletteCube* cube;
+	workerPool* pool;
+} renderSettings;
 
+// rough versions of progressive images go straight to the terminal as they come in, after the first one only the
+// cells that changed get redrawn. previous ends up with what's on screen for the final frame to be compared against
+typedef struct {
+	const renderSettings* settings;
+	cellColor* cells;
+	cellColor* previous;
+	bool shown;
+} previewScreen;
 
-// basically copied from https://github.com/kovidgoyal/kitty/blob/master/kitty/colors.c
-void initLUT() {
-	uint8_t offset = 16;
-	// 6x6x6 color cube
-	uint8_t valueRange[6] = {0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff};
-	for(uint8_t i = 0; i < 216; ++i) {
-		terminalColor c = {
-			valueRange[(i / 36) % 6],
-			valueRange[(i /  6) % 6],
-			valueRange[ i       % 6],
-			0xff,
-		};
-		colorLUT[i+offset] = c;
+static void drawPreview(void* user, const terminalColor* image) {
+	previewScreen* screen = user;
+	const renderSettings* settings = screen->settings;
+	frameBuffer frame;
+	if(!frameInit(&frame, FRAME_MAX_CELL_BYTES)) {
+		return;
+	}
+	if(renderFrame(&frame, image, settings->w, settings->h, 0, 0, settings->blocks, settings->quantize, settings->cube, screen->cells, screen->shown ? screen->previous : NULL, settings->pool) && frameFlush(&frame, STDOUT_FILENO)) {
+		cellColor* swap = screen->previous;
+		screen->previous = screen->cells;
+		screen->cells = swap;
+		screen->shown = true;
 	}
+	frameFree(&frame);
+}
 
-	// grayscale
-	offset = 232;
-	for(uint8_t i = 0; i < 24; ++i) {
-		uint8_t v = 8 + i * 10;
-		terminalColor c = {
-			v,
-			v,
-			v,
-			0xff,
-		};
-		colorLUT[i+offset] = c;
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(UNUSED int signal) {
+	stopRequested = 1;
+}
+
+// sleeps until the given time, or until ctrl+c
+static void waitUntil(const struct timespec* due) {
+	while(!stopRequested && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, due, NULL) == EINTR) {
 	}
 }
 
-void printColorAtLocationWithLUT(unsigned int x, unsigned int y, terminalColor c, terminalColor* lut, size_t lutSize) {
-	printf("\033[%i;%iH", y, x);
-	if(c.a < 250) {
-		printf("\033[0m ");
-		return;
+static void addMilliseconds(struct timespec* time, int ms) {
+	time->tv_sec += ms / 1000;
+	time->tv_nsec += (long)(ms % 1000) * 1000000;
+	if(time->tv_nsec >= 1000000000) {
+		time->tv_nsec -= 1000000000;
+		++time->tv_sec;
+	}
+}
+
+// gifs get played frame by frame and only the cells whose color actually changed get redrawn after the first one
+// takes care of closing animation, with loop it gets opened again from input every time it reaches the end
+bool playAnimation(stbi_gif_frames* animation, const inputFile* input, const renderSettings* settings, bool loop) {
+	unsigned int imageWidth = settings->w * blockColumns[settings->blocks];
+	unsigned int imageHeight = settings->h * blockRows[settings->blocks];
+	size_t pixelCount = (size_t)imageWidth * imageHeight;
+	terminalColor* image = arenaMalloc(sizeof(terminalColor) * pixelCount);
+	cellColor* cells = arenaMalloc(sizeof(cellColor) * pixelCount);
+	cellColor* previous = arenaMalloc(sizeof(cellColor) * pixelCount);
+	frameBuffer frame = {0};
+	bool succeeded = image && cells && previous && frameInit(&frame, FRAME_MAX_CELL_BYTES);
+	if(!succeeded) {
+		printf("Couldn't allocate frame buffer\n");
+	}
+	
+	gridSampler sampler = {
+		.buffer = image,
+		.w = imageWidth,
+		.h = imageHeight,
+		.kernel = settings->kernel,
+		.pool = settings->pool,
+		.rowsPersist = true,
+	};
+	
+	// so ctrl+c still puts the cursor back and resets the colors
+	struct sigaction action = {
+		.sa_handler = requestStop,
+	};
+	sigemptyset(&action.sa_mask);
+	struct sigaction oldInterrupt, oldTerminate;
+	sigaction(SIGINT, &action, &oldInterrupt);
+	sigaction(SIGTERM, &action, &oldTerminate);
+	
+	int imgWidth, imgHeight, delay;
+	unsigned char* pixels = NULL;
+	if(succeeded) {
+		pixels = stbi_gif_frames_next(animation, &imgWidth, &imgHeight, &delay);
+		if(!pixels) {
+			printf("Couldn't load image at location \"%s\"\n", input->path);
+			succeeded = false;
+		}
+	}
+	
+	// no cursor jumping around while frames are drawn
+	if(succeeded && frameReserve(&frame, FRAME_MAX_CELL_BYTES)) {
+		frameAppendLiteral(&frame, "\033[?25l");
 	}
+	
+	struct timespec due;
+	clock_gettime(CLOCK_MONOTONIC, &due);
+	bool firstFrame = true;
+	while(succeeded && pixels && !stopRequested) {
+		rewindSampler(&sampler);
+		for(int y = 0; y < imgHeight; ++y) {
+			sampleRow(&sampler, &pixels[(size_t)y*imgWidth*4], y, imgWidth, imgHeight, 4);
+		}
+		if(sampler.failed || !renderFrame(&frame, image, settings->w, settings->h, 0, 0, settings->blocks, settings->quantize, settings->cube, cells, firstFrame ? NULL : previous, settings->pool)) {
+			printf("Couldn't allocate frame buffer\n");
+			succeeded = false;
+			break;
+		}
+		frameFlush(&frame, STDOUT_FILENO);
+		
+		cellColor* swap = previous;
+		previous = cells;
+		cells = swap;
+		firstFrame = false;
+		
+		// browsers treat really short delays as 100ms and lots of gifs are made expecting that
+		addMilliseconds(&due, delay < 20 ? 100 : delay);
+		// if drawing can't keep up there's no point trying to catch up on a bunch of frames at once
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(now.tv_sec > due.tv_sec + 1) {
+			due = now;
+		}
+		
+		// the next frame gets decoded while this one is still up
+		pixels = stbi_gif_frames_next(animation, &imgWidth, &imgHeight, &delay);
+		if(!pixels && loop) {
+			stbi_gif_frames_close(animation);
+			animation = stbi_gif_frames_open_memory(input->data, input->size);
+			pixels = animation ? stbi_gif_frames_next(animation, &imgWidth, &imgHeight, &delay) : NULL;
+		}
+		if(pixels) {
+			waitUntil(&due);
+		}
+	}
+	
+	if(frame.data && appendFrameEnd(&frame, settings->h) && frameReserve(&frame, FRAME_MAX_CELL_BYTES)) {
+		frameAppendLiteral(&frame, "\033[?25h");
+		frameFlush(&frame, STDOUT_FILENO);
+	}
+	
+	sigaction(SIGINT, &oldInterrupt, NULL);
+	sigaction(SIGTERM, &oldTerminate, NULL);
+	stbi_gif_frames_close(animation);
+	resetSampler(&sampler);
+	frameFree(&frame);
+	arenaFree(image);
+	arenaFree(cells);
+	arenaFree(previous);
+	return succeeded;
+}
+
+// gallery mode lays a bunch of images out as thumbnails with their names underneath, a screen's worth at a time.
+// every tile on a page is a job on the worker pool, whichever thread is free grabs the next one, and each tile
+// gets written out as soon as it's done instead of waiting for the whole page
+#define GALLERY_TILE_WIDTH 24
+#define GALLERY_GAP 2
+
+typedef struct {
+	char** paths;
+	unsigned int count;
+	unsigned int capacity;
+} galleryList;
+
+static bool galleryAdd(galleryList* list, const char* path) {
+	if(list->count == list->capacity) {
+		unsigned int newCapacity = list->capacity ? list->capacity * 2 : 64;
+		char** newPaths = realloc(list->paths, sizeof(char*) * newCapacity);
+		if(!newPaths) {
+			return false;
+		}
+		list->paths = newPaths;
+		list->capacity = newCapacity;
+	}
+	list->paths[list->count] = strdup(path);
+	return list->paths[list->count++] != NULL;
+}
+
+// directories get replaced with the files in them, sorted by name, hidden files are left out
+bool galleryAddPath(galleryList* list, const char* path) {
+	struct stat info;
+	if(stat(path, &info) != 0 || !S_ISDIR(info.st_mode)) {
+		// anything that isn't a directory gets a tile that says whether it worked or not
+		return galleryAdd(list, path);
+	}
+	
+	struct dirent** entries;
+	int entryCount = scandir(path, &entries, NULL, alphasort);
+	if(entryCount < 0) {
+		printf("Couldn't open \"%s\": %s\n", path, strerror(errno));
+		return false;
+	}
+	bool succeeded = true;
+	for(int i = 0; i < entryCount; ++i) {
+		char entryPath[PATH_MAX];
+		if(succeeded && entries[i]->d_name[0] != '.' && snprintf(entryPath, sizeof(entryPath), "%s/%s", path, entries[i]->d_name) < (int)sizeof(entryPath)) {
+			if(stat(entryPath, &info) == 0 && S_ISREG(info.st_mode)) {
+				succeeded = galleryAdd(list, entryPath);
+			}
+		}
+		free(entries[i]);
+	}
+	free(entries);
+	if(!succeeded) {
+		printf("Couldn't allocate the list of images\n");
+	}
+	return succeeded;
+}
+
+void freeGalleryList(galleryList* list) {
+	for(unsigned int i = 0; i < list->count; ++i) {
+		free(list->paths[i]);
+	}
+	free(list->paths);
+	list->paths = NULL;
+	list->count = 0;
+	list->capacity = 0;
+}
+
+typedef struct {
+	char** paths;
+	unsigned int columns;
+	// in cells, not counting the row the name goes in
+	unsigned int tileWidth, tileHeight;
+	// the screen row the page starts at, 0 based
+	unsigned int top;
+	const renderSettings* settings;
+	// tiles get written from whichever thread finished them
+	pthread_mutex_t outputLock;
+	// one arena for every tile that can be in progress at once, each tile takes one off here and puts it back reset
+	arena* arenas;
+	arena** idleArenas;
+	unsigned int idleCount;
+	pthread_mutex_t arenaLock;
+} galleryPage;
+
+// shrinks the image to fit in the tile without stretching it, cells are about twice as tall as they are wide
+// h comes out in cells
+static void fitGalleryTile(unsigned int imgWidth, unsigned int imgHeight, unsigned int tileWidth, unsigned int tileHeight, unsigned int rowsPerCell, unsigned int* w, unsigned int* h) {
+	// in cell widths per pixel
+	double scale = fmin((double)tileWidth / imgWidth, (double)tileHeight * 2 / imgHeight);
+	*w = lround(imgWidth * scale);
+	unsigned int rows = lround(imgHeight * scale * rowsPerCell / 2);
+	*h = (rows + rowsPerCell - 1) / rowsPerCell;
+	if(*w < 1) { *w = 1; }
+	if(*w > tileWidth) { *w = tileWidth; }
+	if(*h < 1) { *h = 1; }
+	if(*h > tileHeight) { *h = tileHeight; }
+}
 
-	uint8_t newColor = 0;
-	uint32_t newColorDistance = UINT32_MAX;
-	uint16_t i;
+// just the file name, cut down to fit under the tile. control characters would mess up the terminal so they become ?
+static void appendGalleryLabel(frameBuffer* frame, const char* path, unsigned int x, unsigned int y, unsigned int width) {
+	const char* name = strrchr(path, '/');
+	name = name && name[1] ? name + 1 : path;
+	if(!frameReserve(frame, FRAME_MAX_CELL_BYTES + strlen(name))) {
+		return;
+	}
+	frameAppendLiteral(frame, "\033[0m");
+	appendCursorMove(frame, x + 1, y + 1);
+	unsigned int columns = 0;
+	for(const unsigned char* c = (const unsigned char*)name; *c; ++c) {
+		// utf-8 continuation bytes don't take up another column
+		bool continuation = (*c & 0xc0) == 0x80;
+		if(!continuation && columns++ == width) {
+			break;
+		}
+		frame->data[frame->size++] = *c < 0x20 || *c == 0x7f ? '?' : *c;
+	}
+}
 
-	for(i = 0; i < lutSize; ++i) {
-// signed int so it doesn't underflow if lut[i] is greater, will always be positive when squared
-		int16_t deltaR = c.r - lut[i].r;
-		int16_t deltaG = c.g - lut[i].g;
-		int16_t deltaB = c.b - lut[i].b;
-// https://stackoverflow.com/questions/4485229/rgb-to-closest-predefined-color
-// still doesn't work perfectly but seems to not be going to gray as much
-		uint32_t currentColorDistance = 
-			deltaR*deltaR*0.299 +
-			deltaG*deltaG*0.587 +
-			deltaB*deltaB*0.114;
-		if(currentColorDistance < newColorDistance) {
-			newColor = i;
-			newColorDistance = currentColorDistance;
+static void drawGalleryTile(galleryPage* page, unsigned int index) {
+	const renderSettings* settings = page->settings;
+	const char* path = page->paths[index];
+	unsigned int slotX = (index % page->columns) * (page->tileWidth + GALLERY_GAP);
+	unsigned int slotY = page->top + (index / page->columns) * (page->tileHeight + 1);
+	unsigned int columnsPerCell = blockColumns[settings->blocks];
+	unsigned int rowsPerCell = blockRows[settings->blocks];
+	
+	frameBuffer frame;
+	if(!frameInit(&frame, FRAME_MAX_CELL_BYTES)) {
+		return;
+	}
+	// this is already running on the pool so everything for this tile happens on this thread
+	workerPool serial;
+	initWorkerPool(&serial, 1);
+	
+	bool drawn = false;
+	inputFile input;
+	decodePlan plan;
+	// planning is only reading the header so it's fine to do it twice, the first one is just to find out the size
+	if(openInputFile(&input, path)) {
+		if(planDecode(&plan, &input, page->tileWidth * columnsPerCell, page->tileHeight * rowsPerCell, settings->kernel, 1)) {
+			unsigned int w, h;
+			fitGalleryTile(plan.imgWidth, plan.imgHeight, page->tileWidth, page->tileHeight, rowsPerCell, &w, &h);
+			size_t pixelCount = (size_t)w * columnsPerCell * h * rowsPerCell;
+			terminalColor* image = arenaMalloc(sizeof(terminalColor) * pixelCount);
+			cellColor* cells = arenaMalloc(sizeof(cellColor) * pixelCount);
+			if(image && cells && planDecode(&plan, &input, w * columnsPerCell, h * rowsPerCell, settings->kernel, 1) && loadPNGtoBuffer(&input, image, &plan, &serial, NULL, NULL)) {
+				unsigned int left = slotX + (page->tileWidth - w) / 2;
+				unsigned int top = slotY + (page->tileHeight - h) / 2;
+				drawn = renderFrame(&frame, image, w, h, left, top, settings->blocks, settings->quantize, settings->cube, cells, NULL, &serial);
+			}
+			arenaFree(image);
+			arenaFree(cells);
 		}
+		closeInputFile(&input);
+	}
+	
+	if(!drawn && frameReserve(&frame, FRAME_MAX_CELL_BYTES)) {
+		frameAppendLiteral(&frame, "\033[0m");
+		appendCursorMove(&frame, slotX + (page->tileWidth + 1) / 2, slotY + page->tileHeight / 2 + 1);
+		frameAppendLiteral(&frame, "?");
 	}
+	appendGalleryLabel(&frame, path, slotX, slotY + page->tileHeight, page->tileWidth);
+	
+	pthread_mutex_lock(&page->outputLock);
+	frameFlush(&frame, STDOUT_FILENO);
+	pthread_mutex_unlock(&page->outputLock);
+	
+	freeWorkerPool(&serial);
+	frameFree(&frame);
+}
+
+static void renderGalleryTile(void* ctx, unsigned int index) {
+	galleryPage* page = ctx;
+	pthread_mutex_lock(&page->arenaLock);
+	arena* tileArena = page->idleArenas[--page->idleCount];
+	pthread_mutex_unlock(&page->arenaLock);
+	
+	arena* previousArena = useArena(tileArena);
+	drawGalleryTile(page, index);
+	useArena(previousArena);
+	
+	resetArena(tileArena);
+	pthread_mutex_lock(&page->arenaLock);
+	page->idleArenas[page->idleCount++] = tileArena;
+	pthread_mutex_unlock(&page->arenaLock);
+}
 
-	printf("\033[48;5;%im ", newColor);
+// settings->w and h are the size of the whole screen here, peakMemory gets the most the tile arenas held between them
+bool playGallery(const galleryList* list, const renderSettings* settings, size_t* peakMemory) {
+	galleryPage page = {
+		.columns = (settings->w + GALLERY_GAP) / (GALLERY_TILE_WIDTH + GALLERY_GAP),
+		.settings = settings,
+	};
+	if(page.columns < 1) {
+		page.columns = 1;
+	}
+	// whatever's left over gets spread over the tiles so they fill the whole width
+	page.tileWidth = (settings->w + GALLERY_GAP) / page.columns;
+	page.tileWidth = page.tileWidth > GALLERY_GAP ? page.tileWidth - GALLERY_GAP : 1;
+	page.tileHeight = page.tileWidth / 2;
+	if(page.tileHeight + 1 > settings->h) {
+		page.tileHeight = settings->h > 1 ? settings->h - 1 : 1;
+	}
+	if(page.tileHeight < 1) {
+		page.tileHeight = 1;
+	}
+	unsigned int rowsPerPage = settings->h / (page.tileHeight + 1);
+	if(rowsPerPage < 1) {
+		rowsPerPage = 1;
+	}
+	unsigned int tilesPerPage = rowsPerPage * page.columns;
+	pthread_mutex_init(&page.outputLock, NULL);
+	
+	frameBuffer frame;
+	if(!frameInit(&frame, FRAME_MAX_CELL_BYTES)) {
+		printf("Couldn't allocate frame buffer\n");
+		return false;
+	}
+	
+	// the calling thread does tiles too
+	unsigned int arenaCount = settings->pool->threadCount + 1;
+	page.arenas = malloc(sizeof(arena) * arenaCount);
+	page.idleArenas = malloc(sizeof(arena*) * arenaCount);
+	if(!page.arenas || !page.idleArenas) {
+		printf("Couldn't allocate frame buffer\n");
+		return false;
+	}
+	for(unsigned int i = 0; i < arenaCount; ++i) {
+		initArena(&page.arenas[i]);
+		page.idleArenas[i] = &page.arenas[i];
+	}
+	page.idleCount = arenaCount;
+	pthread_mutex_init(&page.arenaLock, NULL);
+	
+	// stb_image, the files and the allocations can all fail on their own, those just get a ? tile
+	quietErrors = true;
+	bool succeeded = true;
+	unsigned int bottom = 0;
+	for(unsigned int first = 0; first < list->count; first += tilesPerPage) {
+		unsigned int tileCount = list->count - first < tilesPerPage ? list->count - first : tilesPerPage;
+		unsigned int pageHeight = (tileCount + page.columns - 1) / page.columns * (page.tileHeight + 1);
+		page.paths = &list->paths[first];
+		page.top = 0;
+		if(first > 0) {
+			// scroll the last page up out of the way (it's still in the scrollback) and draw this one in the space that opened up
+			if(!frameReserve(&frame, FRAME_MAX_CELL_BYTES + pageHeight)) {
+				printf("Couldn't allocate frame buffer\n");
+				succeeded = false;
+				break;
+			}
+			frameAppendLiteral(&frame, "\033[0m");
+			appendCursorMove(&frame, 1, settings->h);
+			memset(frame.data + frame.size, '\n', pageHeight);
+			frame.size += pageHeight;
+			frameFlush(&frame, STDOUT_FILENO);
+			page.top = pageHeight < settings->h ? settings->h - pageHeight : 0;
+		}
+		workerPoolRun(settings->pool, renderGalleryTile, &page, tileCount);
+		bottom = page.top + pageHeight;
+	}
+	quietErrors = false;
+	
+	if(frameReserve(&frame, FRAME_MAX_CELL_BYTES)) {
+		frameAppendLiteral(&frame, "\033[0m");
+		appendCursorMove(&frame, 1, bottom);
+		frameAppendLiteral(&frame, "\n");
+		frameFlush(&frame, STDOUT_FILENO);
+	}
+	frameFree(&frame);
+	
+	*peakMemory = 0;
+	for(unsigned int i = 0; i < arenaCount; ++i) {
+		*peakMemory += page.arenas[i].peak;
+		freeArena(&page.arenas[i]);
+	}
+	free(page.arenas);
+	free(page.idleArenas);
+	pthread_mutex_destroy(&page.arenaLock);
+	pthread_mutex_destroy(&page.outputLock);
+	return succeeded;
 }
 
 typedef enum {
@@ -144,26 +3633,68 @@ typedef enum {
 	COLOR_MODE_256,
 } colorModeEnum;
 
+// drawing real pixels instead of colored cells, for terminals that can
+typedef enum {
+	GRAPHICS_NONE,
+	GRAPHICS_SIXEL,
+	// the same image sent three different ways, the file and shared memory ones only work when the terminal's on the same machine
+	GRAPHICS_KITTY,
+	GRAPHICS_KITTY_FILE,
+	GRAPHICS_KITTY_SHM,
+	GRAPHICS_ITERM,
+} graphicsProtocolEnum;
+
+// how many pixels a cell is when the terminal doesn't say, about right for most fonts
+#define DEFAULT_CELL_WIDTH 10
+#define DEFAULT_CELL_HEIGHT 20
+
+// only counts what came out of the arenas, which is everything but the input file and the threads
+static void printMemoryUse(size_t peak) {
+	fprintf(stderr, "Peak memory use: %zu KiB\n", (peak + 1023) / 1024);
+}
+
 int main(int argc, char** argv) {
 	unsigned int termWidth = 0;
 	unsigned int termHeight = 0;
 	colorModeEnum colorMode = COLOR_MODE_RGB;
+	resampleKernelEnum kernel = RESAMPLE_NEAREST;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	blockModeEnum blocks = BLOCKS_NONE;
+	bool loop = false;
+	bool useCache = true;
+	bool showMemory = false;
+	graphicsProtocolEnum graphics = GRAPHICS_NONE;
 	
 	if(argc < 2) {
 		printf(\
 "Usage:\n\
-\t%s [path to image] [parameters]\n\n\
+\t%s [path to image] [parameters]\n\
+\t%s [images or directories...] [parameters]\n\n\
+\tMore than one image or a directory shows them all as thumbnails, - reads an image from stdin\n\n\
 \t-w\tSet the width of the displayed image\n\
 \t-h\tSet the height of the displayed image\n\
 \t-8\tRender the image in 8 color mode\n\
 \t-x\tRender the image in 16 color mode\n\
-\t-f\tRender the image in 256 color mode\n", argv[0]);
+\t-f\tRender the image in 256 color mode\n\
+\t-b\tRender two pixels per cell with half blocks\n\
+\t-B\tRender more pixels per cell with block characters (half, quadrant, sextant, octant),\n\
+\t\tsextants and octants need a font that has them\n\
+\t-l\tKeep looping animated GIFs until interrupted\n\
+\t-n\tDon't use the render cache\n\
+\t-m\tPrint the most memory rendering took to stderr\n\
+\t-r\tSet the resampling kernel (nearest, box, bilinear, lanczos)\n\
+\t-g\tDraw real pixels with a terminal graphics protocol (sixel, kitty, kitty-file,\n\
+\t\tkitty-shm or iterm2), animations just show the first frame\n\
+\t-t\tSet the number of threads to use (defaults to the number of cpus)\n", argv[0], argv[0]);
 		exit(1);
 	}
 	
 	char* filePath = NULL;
+	unsigned int pathCount = 0;
+	galleryList gallery = {0};
 	for(int i = 1; i < argc; ++i){
-		if(argv[i][0] == '-') {
+		// just a - on its own is stdin
+		if(argv[i][0] == '-' && argv[i][1] != '\0') {
 			// check second character in the parameter
 			switch(argv[i][1]){
 				case 'w':
@@ -177,6 +3708,15 @@ int main(int argc, char** argv) {
 						termHeight = atoi(argv[i]);
 					}
 					break;
+				case 't':
+					if(i + 1 >= argc) {
+						printf("-t needs a thread count\n");
+						exit(1);
+					}
+					if(isdigit(argv[++i][0])){
+						threads = atoi(argv[i]);
+					}
+					break;
 				case '8':
 					colorMode = COLOR_MODE_8;
 					break;
@@ -187,6 +3727,77 @@ int main(int argc, char** argv) {
 					initLUT();
 					colorMode = COLOR_MODE_256;
 					break;
+				case 'b':
+					blocks = BLOCKS_HALF;
+					break;
+				case 'B':
+					if(i + 1 >= argc) {
+						printf("-B needs a block type\n");
+						exit(1);
+					}
+					++i;
+					if(strcmp(argv[i], "half") == 0) {
+						blocks = BLOCKS_HALF;
+					} else if(strcmp(argv[i], "quadrant") == 0) {
+						blocks = BLOCKS_QUADRANT;
+					} else if(strcmp(argv[i], "sextant") == 0) {
+						blocks = BLOCKS_SEXTANT;
+					} else if(strcmp(argv[i], "octant") == 0) {
+						blocks = BLOCKS_OCTANT;
+					} else {
+						printf("Unrecognized block type \"%s\"\n", argv[i]);
+						exit(1);
+					}
+					break;
+				case 'l':
+					loop = true;
+					break;
+				case 'n':
+					useCache = false;
+					break;
+				case 'm':
+					showMemory = true;
+					break;
+				case 'r':
+					if(i + 1 >= argc) {
+						printf("-r needs a kernel name\n");
+						exit(1);
+					}
+					++i;
+					if(strcmp(argv[i], "nearest") == 0) {
+						kernel = RESAMPLE_NEAREST;
+					} else if(strcmp(argv[i], "box") == 0) {
+						kernel = RESAMPLE_BOX;
+					} else if(strcmp(argv[i], "bilinear") == 0) {
+						kernel = RESAMPLE_BILINEAR;
+					} else if(strcmp(argv[i], "lanczos") == 0) {
+						kernel = RESAMPLE_LANCZOS;
+					} else {
+						printf("Unrecognized resampling kernel \"%s\"\n", argv[i]);
+						exit(1);
+					}
+					break;
+				case 'g':
+					if(i + 1 >= argc) {
+						printf("-g needs a protocol name\n");
+						exit(1);
+					}
+					++i;
+					if(strcmp(argv[i], "sixel") == 0) {
+						graphics = GRAPHICS_SIXEL;
+					} else if(strcmp(argv[i], "kitty") == 0) {
+						graphics = GRAPHICS_KITTY;
+					} else if(strcmp(argv[i], "kitty-file") == 0) {
+						graphics = GRAPHICS_KITTY_FILE;
+					} else if(strcmp(argv[i], "kitty-shm") == 0) {
+						graphics = GRAPHICS_KITTY_SHM;
+					} else if(strcmp(argv[i], "iterm2") == 0) {
+						graphics = GRAPHICS_ITERM;
+					} else {
+						printf("Unrecognized graphics protocol \"%s\"\n", argv[i]);
+						exit(1);
+					}
+					break;
 				
 				default:
 					printf("Unrecognized parameter \"%s\"\n", argv[i]);
@@ -195,15 +3806,29 @@ int main(int argc, char** argv) {
 			}
 		} else {
 			filePath = argv[i];
+			++pathCount;
+			if(!galleryAddPath(&gallery, argv[i])) {
+				exit(1);
+			}
 		}
 	}
 	if(filePath == NULL) {
 		printf("You need to provide an image\n");
 		exit(1);
 	}
+	struct stat pathInfo;
+	bool galleryMode = pathCount > 1 || (stat(filePath, &pathInfo) == 0 && S_ISDIR(pathInfo.st_mode));
+	if(galleryMode && gallery.count == 0) {
+		printf("There aren't any files to show\n");
+		exit(1);
+	}
+	if(galleryMode && graphics != GRAPHICS_NONE) {
+		printf("Graphics protocols only work with a single image\n");
+		exit(1);
+	}
 	
 	// https://iqcode.com/code/c/terminal-size-in-c
-	struct winsize w;
+	struct winsize w = {0};
 	ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
 	
 	if(termWidth < 1) {
@@ -213,34 +3838,253 @@ int main(int argc, char** argv) {
 		termHeight = w.ws_row;
 	}
 	
-	terminalColor* terminalImage = malloc(sizeof(terminalColor) * termWidth * termHeight);
+	// graphics protocols fill the same cells but with a pixel per pixel instead of one per cell
+	unsigned int cellWidth = w.ws_col && w.ws_xpixel ? w.ws_xpixel / w.ws_col : DEFAULT_CELL_WIDTH;
+	unsigned int cellHeight = w.ws_row && w.ws_ypixel ? w.ws_ypixel / w.ws_row : DEFAULT_CELL_HEIGHT;
+	unsigned int imageWidth = termWidth * blockColumns[blocks];
+	unsigned int imageHeight = termHeight * blockRows[blocks];
+	if(graphics != GRAPHICS_NONE) {
+		imageWidth = termWidth * cellWidth;
+		imageHeight = termHeight * cellHeight;
+	}
 	
-	if(!loadPNGtoBuffer(filePath, terminalImage, termWidth, termHeight)){
-		exit(1);
+	bool kitty = graphics == GRAPHICS_KITTY || graphics == GRAPHICS_KITTY_FILE || graphics == GRAPHICS_KITTY_SHM;
+	kittyTransferEnum transfer = KITTY_DIRECT;
+	if(graphics == GRAPHICS_KITTY_FILE) { transfer = KITTY_FILE;          }
+	if(graphics == GRAPHICS_KITTY_SHM)  { transfer = KITTY_SHARED_MEMORY; }
+	// only kitty ever deletes the file or shared memory, when the output goes anywhere else they'd just pile up
+	if(!isatty(STDOUT_FILENO)) {
+		transfer = KITTY_DIRECT;
 	}
-
-	size_t lutSize;
+	bool iterm = graphics == GRAPHICS_ITERM;
+	
+	// a cache hit doesn't need anything else set up, files and shared memory are gone once the terminal's read them
+	// so a frame that points at them can only be shown once
+	renderCache cache;
+	bool cacheable = useCache && !galleryMode && transfer == KITTY_DIRECT && initRenderCache(&cache, filePath, imageWidth, imageHeight, termWidth, termHeight, colorMode, kernel, blocks, graphics);
+	if(cacheable && renderCacheServe(&cache, STDOUT_FILENO)) {
+		freeGalleryList(&gallery);
+		return 0;
+	}
+	
+	initKernels();
+	
+	size_t lutSize = 0;
 	if(colorMode == COLOR_MODE_8)   { lutSize = 8;   }
 	if(colorMode == COLOR_MODE_16)  { lutSize = 16;  }
 	if(colorMode == COLOR_MODE_256) { lutSize = 256; }
+	
+	static paletteCube colorCube;
+	if(colorMode != COLOR_MODE_RGB) {
+		initPaletteCube(&colorCube, colorLUT, lutSize);
+	}
 
 	// probably really dumb but I'm doing this to get the color mode checks out of the loop
-	void (*functionPointer)(unsigned int x, unsigned int y, terminalColor c, terminalColor* lut, size_t lutSize);
+	quantizeRowFunc functionPointer;
 	if(colorMode == COLOR_MODE_RGB) {
-		functionPointer = printColorAtLocation;
+		functionPointer = quantizeRowKernel;
 	} else {
-		functionPointer = printColorAtLocationWithLUT;
+		functionPointer = quantizeRowWithLUTKernel;
+	}
+	
+	if(galleryMode) {
+		workerPool pool;
+		if(!initWorkerPool(&pool, threads > 0 ? threads : 1)) {
+			printf("Couldn't start worker threads\n");
+			exit(1);
+		}
+		renderSettings settings = {
+			.w = termWidth,
+			.h = termHeight,
+			.blocks = blocks,
+			.kernel = kernel,
+			.quantize = functionPointer,
+			.cube = &colorCube,
+			.pool = &pool,
+		};
+		size_t peakMemory = 0;
+		bool shown = playGallery(&gallery, &settings, &peakMemory);
+		freeGalleryList(&gallery);
+		freeWorkerPool(&pool);
+		if(showMemory) {
+			printMemoryUse(peakMemory);
+		}
+		return shown ? 0 : 1;
+	}
+	freeGalleryList(&gallery);
+	
+	inputFile input;
+	if(!openInputFile(&input, filePath)) {
+		exit(1);
+	}
+	
+	decodePlan plan;
+	if(!planDecode(&plan, &input, imageWidth, imageHeight, kernel, threads > 0 ? threads : 1)) {
+		exit(1);
+	}
+	// kitty and iterm2 scale the image up to fill the cells themselves, so it's only ever shrunk to fit the window
+	if((kitty || iterm) && (plan.imgWidth < imageWidth || plan.imgHeight < imageHeight)) {
+		imageWidth = plan.imgWidth < imageWidth ? plan.imgWidth : imageWidth;
+		imageHeight = plan.imgHeight < imageHeight ? plan.imgHeight : imageHeight;
+		if(!planDecode(&plan, &input, imageWidth, imageHeight, kernel, threads > 0 ? threads : 1)) {
+			exit(1);
+		}
+	}
+	
+	// everything from here on is for this one render
+	arena renderArena;
+	if(!initArena(&renderArena)) {
+		printf("Couldn't allocate frame buffer\n");
+		exit(1);
+	}
+	useArena(&renderArena);
+	
+	// terminals that read pngs (iterm2 jpegs too) themselves can just be handed the file, which only needs the header
+	// looked at. through the tty that's worth it as long as the file's no bigger than the pixels would be, and when
+	// kitty reads it from somewhere else it always is
+	if((kitty && plan.png) || (iterm && (plan.png || plan.jpeg))) {
+		size_t pixelBytes = (size_t)imageWidth * imageHeight * (plan.channels == 2 || plan.channels == 4 ? 4 : 3);
+		if(transfer != KITTY_DIRECT || input.size <= pixelBytes) {
+			frameBuffer frame;
+			if(!frameInit(&frame, FRAME_MAX_CELL_BYTES)) {
+				printf("Couldn't allocate frame buffer\n");
+				exit(1);
+			}
+			bool rendered = kitty ? renderKittyPNG(&frame, &input, termWidth, termHeight, transfer) : renderITerm(&frame, input.data, input.size, termWidth, termHeight);
+			if(!rendered && transfer != KITTY_DIRECT) {
+				printf("Couldn't write the image somewhere the terminal can read it\n");
+				exit(1);
+			}
+			if(!rendered || !appendFrameEnd(&frame, termHeight)) {
+				printf("Couldn't allocate frame buffer\n");
+				exit(1);
+			}
+			frameFlush(&frame, STDOUT_FILENO);
+			
+			frameFree(&frame);
+			closeInputFile(&input);
+			if(showMemory) {
+				printMemoryUse(renderArena.peak);
+			}
+			freeArena(&renderArena);
+			return 0;
+		}
+	}
+	
+	workerPool pool;
+	if(!initWorkerPool(&pool, plan.threads)) {
+		printf("Couldn't start worker threads\n");
+		exit(1);
+	}
+	// gallery mode never gets here, its tiles are already decoding on the pool so they can't hand it more work
+	if(plan.threads > 1) {
+		stbi_set_parallel_for(runDecodeJobs, &pool);
+	}
+	
+	stbi_gif_frames* animation = plan.animated && graphics == GRAPHICS_NONE ? stbi_gif_frames_open_memory(input.data, input.size) : NULL;
+	if(animation) {
+		renderSettings settings = {
+			.w = termWidth,
+			.h = termHeight,
+			.blocks = blocks,
+			.kernel = plan.kernel,
+			.quantize = functionPointer,
+			.cube = &colorCube,
+			.pool = &pool,
+		};
+		bool played = playAnimation(animation, &input, &settings, loop);
+		closeInputFile(&input);
+		freeWorkerPool(&pool);
+		if(showMemory) {
+			printMemoryUse(renderArena.peak);
+		}
+		freeArena(&renderArena);
+		return played ? 0 : 1;
+	}
+	
+	terminalColor* terminalImage = arenaMalloc(sizeof(terminalColor) * imageWidth * imageHeight);
+	// graphics protocols go straight from the pixels
+	bool useCells = graphics == GRAPHICS_NONE;
+	cellColor* cells = useCells ? arenaMalloc(sizeof(cellColor) * imageWidth * imageHeight) : NULL;
+	// previews are only worth it when someone's watching, piped output just gets the final frame
+	bool previews = useCells && plan.progressive && isatty(STDOUT_FILENO);
+	cellColor* previous = previews ? arenaMalloc(sizeof(cellColor) * imageWidth * imageHeight) : NULL;
+	if(!terminalImage || (useCells && !cells) || (previews && !previous)) {
+		printf("Couldn't allocate frame buffer\n");
+		exit(1);
+	}
+	
+	renderSettings settings = {
+		.w = termWidth,
+		.h = termHeight,
+		.blocks = blocks,
+		.kernel = plan.kernel,
+		.quantize = functionPointer,
+		.cube = &colorCube,
+		.pool = &pool,
+	};
+	previewScreen screen = {
+		.settings = &settings,
+		.cells = cells,
+		.previous = previous,
+	};
+	if(!loadPNGtoBuffer(&input, terminalImage, &plan, &pool, previews ? drawPreview : NULL, &screen)){
+		exit(1);
+	}
+	closeInputFile(&input);
+	
+	// renderFrame reserves exactly what the bands ended up needing, this is just for the bit at the end
+	frameBuffer frame;
+	if(!frameInit(&frame, FRAME_MAX_CELL_BYTES)) {
+		printf("Couldn't allocate frame buffer\n");
+		exit(1);
 	}
 	
-	for(unsigned int x = 0; x < termWidth; ++x){
-		for(unsigned int y = 0; y < termHeight; ++y){
-			(*functionPointer)(x, y, terminalImage[(y*termWidth)+x], colorLUT, lutSize);
+	// the cache needs the whole frame even when only what changed since the last preview gets written out
+	if(cacheable && screen.shown) {
+		frameBuffer full;
+		if(frameInit(&full, FRAME_MAX_CELL_BYTES)) {
+			if(renderFrame(&full, terminalImage, termWidth, termHeight, 0, 0, blocks, functionPointer, &colorCube, screen.cells, NULL, &pool) && appendFrameEnd(&full, termHeight)) {
+				renderCacheStore(&cache, &full);
+			}
+			frameFree(&full);
 		}
 	}
-	// moves to the bottom since it messes up when displaying transparent images for some reason
-	printf("\033[H\033[%iB\033[0m\n", termHeight);
 	
-	free(terminalImage);
+	bool rendered;
+	if(graphics == GRAPHICS_SIXEL) {
+		rendered = renderSixel(&frame, terminalImage, imageWidth, imageHeight, &pool);
+	} else if(kitty) {
+		rendered = renderKitty(&frame, terminalImage, imageWidth, imageHeight, termWidth, termHeight, transfer);
+	} else if(iterm) {
+		rendered = renderITermPixels(&frame, terminalImage, imageWidth, imageHeight, termWidth, termHeight);
+	} else {
+		rendered = renderFrame(&frame, terminalImage, termWidth, termHeight, 0, 0, blocks, functionPointer, &colorCube, screen.cells, screen.shown ? screen.previous : NULL, &pool);
+	}
+	if(!rendered && transfer != KITTY_DIRECT) {
+		printf("Couldn't write the image somewhere the terminal can read it\n");
+		exit(1);
+	}
+	if(!rendered || !appendFrameEnd(&frame, termHeight)) {
+		printf("Couldn't allocate frame buffer\n");
+		exit(1);
+	}
+	if(cacheable && !screen.shown) {
+		renderCacheStore(&cache, &frame);
+	}
+	
+	// stdout isn't used for anything else before this so there's nothing buffered in stdio to get out of order with
+	frameFlush(&frame, STDOUT_FILENO);
+	
+	frameFree(&frame);
+	arenaFree(screen.cells);
+	arenaFree(screen.previous);
+	arenaFree(terminalImage);
+	freeWorkerPool(&pool);
+	if(showMemory) {
+		printMemoryUse(renderArena.peak);
+	}
+	freeArena(&renderArena);
 	
 	return 0;
 }
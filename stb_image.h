@@ -420,6 +420,24 @@ typedef struct
 STBIDEF stbi_uc *stbi_load_from_memory   (stbi_uc           const *buffer, int len   , int *x, int *y, int *channels_in_file, int desired_channels);
 STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk  , void *user, int *x, int *y, int *channels_in_file, int desired_channels);
 
+// same as stbi_load_from_memory, but the image may come back smaller when the
+// format can decode at a reduced size for cheap. JPEGs are decoded at 1/2,
+// 1/4 or 1/8 scale straight from the DCT coefficients, picking the smallest
+// scale that is still at least min_x by min_y. other formats load normally,
+// so always use the returned *x and *y.
+STBIDEF stbi_uc *stbi_load_reduced_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int min_x, int min_y);
+
+// same as stbi_load_reduced_from_memory, but progressive JPEGs and 8-bit
+// interlaced PNGs also hand the image as it looks so far to 'callback' after
+// each scan/pass, so something can be shown before the whole thing is
+// decoded. 'pixels' is the full (reduced) size with desired_channels
+// components and is only valid during the call; unfinished parts of PNGs are
+// filled in with the nearest pixel decoded so far. 'pass' counts up from 1.
+// the final image is returned as usual and never goes to the callback.
+typedef void stbi_pass_callback(void *user, const stbi_uc *pixels, int w, int h, int comp, int pass);
+
+STBIDEF stbi_uc *stbi_load_progressive_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int min_x, int min_y, stbi_pass_callback *callback, void *user);
+
 #ifndef STBI_NO_STDIO
 STBIDEF stbi_uc *stbi_load            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
 STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
@@ -428,6 +446,35 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
+
+// frame-at-a-time gif loading: only the current canvas (plus the two frames
+// needed for disposal) is kept, instead of every frame like the call above.
+// open returns NULL if the data isn't a gif. next returns the composited
+// frame as 4 channel RGBA, valid until the next call, or NULL once there are
+// no frames left (or on error). delay is in milliseconds.
+typedef struct stbi_gif_frames stbi_gif_frames;
+
+STBIDEF stbi_gif_frames *stbi_gif_frames_open_memory(stbi_uc const *buffer, int len);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_gif_frames *stbi_gif_frames_open       (char const *filename);
+#endif
+STBIDEF stbi_uc         *stbi_gif_frames_next       (stbi_gif_frames *frames, int *x, int *y, int *delay);
+STBIDEF void             stbi_gif_frames_close      (stbi_gif_frames *frames);
+#endif
+
+#ifndef STBI_NO_PNG
+// row-at-a-time loading: each row is handed to the callback as soon as it's
+// decoded and then thrown away, so the full image is never held in memory.
+// 'row' has desired_channels (1..4) components, 'comp' is channels_in_file.
+// only 8-bit non-interlaced PNGs can be streamed; for anything else these
+// return 0 before any rows are delivered and you should fall back to a
+// regular load. returns 1 once every row has been delivered.
+typedef void stbi_row_callback(void *user, const stbi_uc *row, int y, int w, int h, int comp);
+
+STBIDEF int stbi_load_rows_from_memory(stbi_uc const *buffer, int len, int desired_channels, stbi_row_callback *callback, void *user);
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_rows            (char const *filename, int desired_channels, stbi_row_callback *callback, void *user);
+#endif
 #endif
 
 #ifdef STBI_WINDOWS_UTF8
@@ -493,6 +540,21 @@ STBIDEF int      stbi_info_from_callbacks(stbi_io_callbacks const *clbk, void *u
 STBIDEF int      stbi_is_16_bit_from_memory(stbi_uc const *buffer, int len);
 STBIDEF int      stbi_is_16_bit_from_callbacks(stbi_io_callbacks const *clbk, void *user);
 
+// everything stbi_info and stbi_is_16_bit report, plus what's needed to
+// decide how to decode before doing any of it. only reads the headers
+// (and for gifs, walks the block structure to count frames)
+typedef struct
+{
+   int x, y, comp;
+   int is_16_bit;
+   int is_jpeg;      // can use stbi_load_reduced_from_memory
+   int is_png;
+   int progressive;  // progressive jpeg or interlaced png/gif
+   int frames;       // 1 unless it's an animated gif
+} stbi_probe;
+
+STBIDEF int      stbi_probe_from_memory(stbi_uc const *buffer, int len, stbi_probe *probe);
+
 #ifndef STBI_NO_STDIO
 STBIDEF int      stbi_info               (char const *filename,     int *x, int *y, int *comp);
 STBIDEF int      stbi_info_from_file     (FILE *f,                  int *x, int *y, int *comp);
@@ -514,6 +576,15 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 // flip the image vertically, so the first pixel in the output array is the bottom left
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+// baseline jpegs with restart markers can have their restart intervals decoded
+// in parallel. stbi doesn't start threads itself; give it a function that calls
+// job(ctx, i) for every i in [0,count) (in any order, on any threads) and only
+// returns once they're all done. pass NULL to go back to decoding in order.
+// only applies to images loaded from memory.
+typedef void stbi_job(void *ctx, unsigned int index);
+typedef void stbi_parallel_for(void *runner, stbi_job *job, void *ctx, unsigned int count);
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for *run, void *runner);
+
 // as above, but only applies to images loaded on the thread that calls the function
 // this function is only available if your compiler supports thread-local variables;
 // calling it will fail to link if your compiler doesn't
@@ -640,12 +711,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -814,6 +887,10 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   int reduce_min_x, reduce_min_y; // see stbi_load_reduced_from_memory, 0 = full size
+   stbi_pass_callback *pass_callback; // see stbi_load_progressive_from_memory
+   void *pass_user;
 } stbi__context;
 
 
@@ -825,6 +902,8 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->io.read = NULL;
    s->read_from_callbacks = 0;
    s->callback_already_read = 0;
+   s->reduce_min_x = s->reduce_min_y = 0;
+   s->pass_callback = NULL;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
 }
@@ -837,6 +916,8 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
    s->callback_already_read = 0;
+   s->reduce_min_x = s->reduce_min_y = 0;
+   s->pass_callback = NULL;
    s->img_buffer = s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
@@ -1091,6 +1172,15 @@ static float   *stbi__ldr_to_hdr(stbi_uc *data, int x, int y, int comp);
 static stbi_uc *stbi__hdr_to_ldr(float   *data, int x, int y, int comp);
 #endif
 
+static stbi_parallel_for *stbi__parallel_for = NULL;
+static void *stbi__parallel_runner = NULL;
+
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for *run, void *runner)
+{
+   stbi__parallel_for = run;
+   stbi__parallel_runner = runner;
+}
+
 static int stbi__vertically_flip_on_load_global = 0;
 
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
@@ -1413,6 +1503,26 @@ STBIDEF stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, i
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF stbi_uc *stbi_load_reduced_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int min_x, int min_y)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   s.reduce_min_x = min_x;
+   s.reduce_min_y = min_y;
+   return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+}
+
+STBIDEF stbi_uc *stbi_load_progressive_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int min_x, int min_y, stbi_pass_callback *callback, void *user)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   s.reduce_min_x = min_x;
+   s.reduce_min_y = min_y;
+   s.pass_callback = callback;
+   s.pass_user = user;
+   return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
+}
+
 STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
 {
    stbi__context s;
@@ -1974,6 +2084,9 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+   int scale_shift; // decoded size is 1/(1<<scale_shift), each block becomes (8>>scale_shift)^2 pixels
+   int req_comp;    // so previews come out the same as the final image
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
@@ -2489,6 +2602,65 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced size idcts: only the lowest n x n frequencies of the block are
+// transformed, straight to n x n pixels. that's close to doing the full idct
+// and averaging the result down, but much less work. the tables hold
+// C(u) * cos((2x+1)*u*pi / 2n) for each output x and frequency u
+static const float stbi__idct_reduced_cos4[4][4] =
+{
+   { 0.70710678f,  0.92387953f,  0.70710678f,  0.38268343f },
+   { 0.70710678f,  0.38268343f, -0.70710678f, -0.92387953f },
+   { 0.70710678f, -0.38268343f, -0.70710678f,  0.92387953f },
+   { 0.70710678f, -0.92387953f,  0.70710678f, -0.38268343f },
+};
+
+static const float stbi__idct_reduced_cos2[2][2] =
+{
+   { 0.70710678f,  0.70710678f },
+   { 0.70710678f, -0.70710678f },
+};
+
+static void stbi__idct_reduced(stbi_uc *out, int out_stride, short data[64], int n, const float *cos_table)
+{
+   float tmp[4][4];
+   int x,y,u,v;
+   // rows first: tmp[v][x] is frequency row v transformed horizontally
+   for (v=0; v < n; ++v) {
+      for (x=0; x < n; ++x) {
+         float sum = 0;
+         for (u=0; u < n; ++u)
+            sum += data[v*8+u] * cos_table[x*n+u];
+         tmp[v][x] = sum;
+      }
+   }
+   for (y=0; y < n; ++y, out += out_stride) {
+      for (x=0; x < n; ++x) {
+         float sum = 0;
+         for (v=0; v < n; ++v)
+            sum += tmp[v][x] * cos_table[y*n+v];
+         // 1/4 from the idct, then undo the level shift
+         out[x] = stbi__clamp((int) (sum * 0.25f + 128.5f));
+      }
+   }
+}
+
+static void stbi__idct_block_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+   stbi__idct_reduced(out, out_stride, data, 4, &stbi__idct_reduced_cos4[0][0]);
+}
+
+static void stbi__idct_block_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+   stbi__idct_reduced(out, out_stride, data, 2, &stbi__idct_reduced_cos2[0][0]);
+}
+
+static void stbi__idct_block_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+   STBI_NOTUSED(out_stride);
+   // just the DC term, which is 8x the block average
+   out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2912,9 +3084,147 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// every restart interval starts with the dc predictions and the bit reader reset,
+// so once we know where each one begins in the file they can all be decoded at
+// the same time. only done for baseline scans held in memory, since the whole
+// scan has to be searched for its restart markers up front.
+#define STBI__JPEG_UNITS_PER_JOB  512
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi_uc **start;      // first byte of each restart interval
+   int intervals;
+   int per_job;          // restart intervals handed to each job
+   int units_w, units;   // blocks (one component) or mcus (interleaved) per row and in total
+   int *ok;              // one per job
+} stbi__jpeg_parallel;
+
+// decode one block of a single-component scan, or one whole mcu of an interleaved one
+static int stbi__jpeg_decode_unit(stbi__jpeg *z, short data[64], int i, int j)
+{
+   int k,x,y,bs = 8 >> z->scale_shift;
+   if (z->scan_n == 1) {
+      int n = z->order[0], ha = z->img_comp[n].ha;
+      if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+      z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data);
+      return 1;
+   }
+   for (k=0; k < z->scan_n; ++k) {
+      int n = z->order[k], ha = z->img_comp[n].ha;
+      for (y=0; y < z->img_comp[n].v; ++y) {
+         for (x=0; x < z->img_comp[n].h; ++x) {
+            int x2 = (i*z->img_comp[n].h + x)*bs;
+            int y2 = (j*z->img_comp[n].v + y)*bs;
+            if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+            z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+         }
+      }
+   }
+   return 1;
+}
+
+static void stbi__jpeg_decode_intervals(void *ctx, unsigned int index)
+{
+   stbi__jpeg_parallel *p = (stbi__jpeg_parallel *) ctx;
+   int first = (int) index * p->per_job;
+   int last = first + p->per_job < p->intervals ? first + p->per_job : p->intervals;
+   int r,u,end;
+   STBI_SIMD_ALIGN(short, data[64]);
+   // each job gets its own bit reader, dc predictions and read position; the
+   // tables are copied along with them, and the output blocks never overlap
+   stbi__context s = *p->z->s;
+   stbi__jpeg *z = (stbi__jpeg *) stbi__malloc(sizeof(*z));
+   p->ok[index] = 0;
+   if (!z) return;
+   memcpy(z, p->z, sizeof(*z));
+   z->s = &s;
+   for (r=first; r < last; ++r) {
+      s.img_buffer = p->start[r];
+      stbi__jpeg_reset(z);
+      u = r * z->restart_interval;
+      end = u + z->restart_interval < p->units ? u + z->restart_interval : p->units;
+      for (; u < end; ++u) {
+         if (!stbi__jpeg_decode_unit(z, data, u % p->units_w, u / p->units_w)) {
+            STBI_FREE(z);
+            return;
+         }
+      }
+   }
+   STBI_FREE(z);
+   p->ok[index] = 1;
+}
+
+// finds where each restart interval of the scan starts and the marker after the
+// scan. fails if the restart markers don't line up with the restart interval, the
+// normal decoder copes with that better than guessing would
+static int stbi__jpeg_find_restarts(stbi__jpeg *z, stbi_uc **start, int intervals, stbi_uc **after, stbi_uc *marker)
+{
+   stbi_uc *p = z->s->img_buffer, *e = z->s->img_buffer_end;
+   int n = 1;
+   start[0] = p;
+   while (p < e) {
+      stbi_uc c;
+      p = (stbi_uc *) memchr(p, 0xff, e-p);
+      if (!p) return 0;
+      while (++p < e && *p == 0xff); // fill bytes
+      if (p == e) return 0;
+      c = *p++;
+      if (c == 0) continue; // stuffed 0xff in the data
+      if (!STBI__RESTART(c)) {
+         *after = p;
+         *marker = c;
+         return n == intervals;
+      }
+      if (n == intervals) return 0;
+      start[n++] = p;
+   }
+   return 0;
+}
+
+static int stbi__jpeg_parallel_scan(stbi__jpeg *z)
+{
+   stbi__jpeg_parallel p;
+   stbi_uc *after = NULL, marker = 0;
+   int jobs, i, ok;
+
+   if (z->scan_n == 1) {
+      p.units_w = (z->img_comp[z->order[0]].x+7) >> 3;
+      p.units = p.units_w * ((z->img_comp[z->order[0]].y+7) >> 3);
+   } else {
+      p.units_w = z->img_mcu_x;
+      p.units = z->img_mcu_x * z->img_mcu_y;
+   }
+   p.z = z;
+   p.intervals = (p.units + z->restart_interval - 1) / z->restart_interval;
+   p.per_job = (STBI__JPEG_UNITS_PER_JOB + z->restart_interval - 1) / z->restart_interval;
+   jobs = (p.intervals + p.per_job - 1) / p.per_job;
+   if (jobs < 2) return 0;
+
+   p.start = (stbi_uc **) stbi__malloc_mad2(p.intervals, sizeof(*p.start), 0);
+   p.ok = (int *) stbi__malloc_mad2(jobs, sizeof(*p.ok), 0);
+   ok = p.start && p.ok && stbi__jpeg_find_restarts(z, p.start, p.intervals, &after, &marker);
+   if (ok) {
+      stbi__parallel_for(stbi__parallel_runner, stbi__jpeg_decode_intervals, &p, (unsigned int) jobs);
+      for (i=0; i < jobs; ++i)
+         ok &= p.ok[i];
+   }
+   STBI_FREE(p.start);
+   STBI_FREE(p.ok);
+   if (!ok) return 0;
+   // carry on from the marker after the scan, like the normal decoder would
+   z->s->img_buffer = after;
+   z->marker = marker;
+   return 1;
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
+   // if it doesn't work out the scan is decoded again in order, which overwrites
+   // everything the jobs wrote and fails (or doesn't) the same way it always has
+   if (!z->progressive && z->restart_interval && stbi__parallel_for && !z->s->read_from_callbacks)
+      if (stbi__jpeg_parallel_scan(z)) return 1;
    if (!z->progressive) {
       if (z->scan_n == 1) {
          int i,j;
@@ -2929,8 +3239,9 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
+               int bs = 8 >> z->scale_shift;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2954,8 +3265,8 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
+                        int x2 = (i*z->img_comp[n].h + x)*(8 >> z->scale_shift);
+                        int y2 = (j*z->img_comp[n].v + y)*(8 >> z->scale_shift);
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
                         z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
@@ -3054,8 +3365,9 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+               int bs = 8 >> z->scale_shift;
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*bs+i*bs, z->img_comp[n].w2, data);
             }
          }
       }
@@ -3283,6 +3595,20 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
    z->img_mcu_x = (s->img_x + z->img_mcu_w-1) / z->img_mcu_w;
    z->img_mcu_y = (s->img_y + z->img_mcu_h-1) / z->img_mcu_h;
 
+   // pick the smallest idct output size that still covers what the caller asked for
+   z->scale_shift = 0;
+   if (s->reduce_min_x > 0 || s->reduce_min_y > 0) {
+      while (z->scale_shift < 3) {
+         int next = z->scale_shift + 1;
+         if ((int) ((s->img_x + (1u << next)-1) >> next) < s->reduce_min_x) break;
+         if ((int) ((s->img_y + (1u << next)-1) >> next) < s->reduce_min_y) break;
+         z->scale_shift = next;
+      }
+   }
+   if (z->scale_shift == 1) z->idct_block_kernel = stbi__idct_block_4x4;
+   if (z->scale_shift == 2) z->idct_block_kernel = stbi__idct_block_2x2;
+   if (z->scale_shift == 3) z->idct_block_kernel = stbi__idct_block_1x1;
+
    for (i=0; i < s->img_n; ++i) {
       // number of effective pixels (e.g. for non-interleaved MCU)
       z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max-1) / h_max;
@@ -3293,9 +3619,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // discard the extra data until colorspace conversion
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
-      // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      // so these muls can't overflow with 32-bit ints (which we require).
+      // when decoding reduced, each block only takes up 8>>scale_shift pixels
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale_shift);
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * (8 >> z->scale_shift);
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3305,13 +3632,16 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
+         // previews idct every component after each scan, and a component whose DC scan hasn't come yet
+         // has to read as flat grey rather than whatever the allocator left there
+         if (z->s->pass_callback)
+            memset(z->img_comp[i].coeff, 0, z->img_comp[i].coeff_w * z->img_comp[i].coeff_h * 64 * sizeof(short));
       }
    }
 
@@ -3351,10 +3681,12 @@ static int stbi__decode_jpeg_header(stbi__jpeg *z, int scan)
    return 1;
 }
 
+static void stbi__jpeg_preview(stbi__jpeg *z, int pass);
+
 // decode image to YCbCr format
 static int stbi__decode_jpeg_image(stbi__jpeg *j)
 {
-   int m;
+   int m, pass = 0;
    for (m = 0; m < 4; m++) {
       j->img_comp[m].raw_data = NULL;
       j->img_comp[m].raw_coeff = NULL;
@@ -3377,6 +3709,8 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
             }
             // if we reach eof without hitting a marker, stbi__get_marker() below will fail and we'll eventually return 0
          }
+         if (j->progressive && j->s->pass_callback)
+            stbi__jpeg_preview(j, ++pass);
       } else if (stbi__DNL(m)) {
          int Ld = stbi__get16be(j->s);
          stbi__uint32 NL = stbi__get16be(j->s);
@@ -3766,6 +4100,7 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
+   j->scale_shift = 0;
    j->idct_block_kernel = stbi__idct_block;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
@@ -3808,167 +4143,237 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// everything after the idct works on the reduced size
+static void stbi__jpeg_use_reduced_size(stbi__jpeg *z)
 {
-   int n, decode_n, is_rgb;
-   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
-
-   // validate req_comp
-   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
-
-   // load a jpeg image from whichever source, but leave in YCbCr format
-   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+   int n, sh = z->scale_shift;
+   if (!sh) return;
+   z->s->img_x = (z->s->img_x + (1u << sh)-1) >> sh;
+   z->s->img_y = (z->s->img_y + (1u << sh)-1) >> sh;
+   for (n=0; n < z->s->img_n; ++n) {
+      z->img_comp[n].x = (z->img_comp[n].x + (1 << sh)-1) >> sh;
+      z->img_comp[n].y = (z->img_comp[n].y + (1 << sh)-1) >> sh;
+   }
+}
 
-   // determine actual number of components to generate
-   n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+// determine actual number of components to generate
+static void stbi__jpeg_output_components(stbi__jpeg *z, int req_comp, int *n, int *decode_n, int *is_rgb)
+{
+   *n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
-   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+   *is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
 
-   if (z->s->img_n == 3 && n < 3 && !is_rgb)
-      decode_n = 1;
+   if (z->s->img_n == 3 && *n < 3 && !*is_rgb)
+      *decode_n = 1;
    else
-      decode_n = z->s->img_n;
-
-   // nothing to do if no components requested; check this now to avoid
-   // accessing uninitialized coutput[0] later
-   if (decode_n <= 0) { stbi__cleanup_jpeg(z); return NULL; }
+      *decode_n = z->s->img_n;
+}
 
-   // resample and color-convert
-   {
-      int k;
-      unsigned int i,j;
-      stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+// resample and color-convert the decoded planes into output, n components by img_x by img_y
+static int stbi__jpeg_convert(stbi__jpeg *z, stbi_uc *output, int n, int decode_n, int is_rgb)
+{
+   int k;
+   unsigned int i,j;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
 
-      stbi__resample res_comp[4];
+   stbi__resample res_comp[4];
 
-      for (k=0; k < decode_n; ++k) {
-         stbi__resample *r = &res_comp[k];
+   for (k=0; k < decode_n; ++k) {
+      stbi__resample *r = &res_comp[k];
 
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
+      // allocate line buffer big enough for upsampling off the edges
+      // with upsample factor of 4. previews reuse the one from last time
+      if (!z->img_comp[k].linebuf) {
          z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
-         r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
-         r->ypos    = 0;
-         r->line0   = r->line1 = z->img_comp[k].data;
-
-         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-         else                               r->resample = stbi__resample_row_generic;
+         if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
       }
 
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
+      r->hs      = z->img_h_max / z->img_comp[k].h;
+      r->vs      = z->img_v_max / z->img_comp[k].v;
+      r->ystep   = r->vs >> 1;
+      r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+      r->ypos    = 0;
+      r->line0   = r->line1 = z->img_comp[k].data;
+
+      if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+      else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+      else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+      else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+      else                               r->resample = stbi__resample_row_generic;
+   }
+
+   // now go ahead and resample
+   for (j=0; j < z->s->img_y; ++j) {
+      stbi_uc *out = output + n * z->s->img_x * j;
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &res_comp[k];
+         int y_bot = r->ystep >= (r->vs >> 1);
+         coutput[k] = r->resample(z->img_comp[k].linebuf,
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs);
+         if (++r->ystep >= r->vs) {
+            r->ystep = 0;
+            r->line0 = r->line1;
+            if (++r->ypos < z->img_comp[k].y)
+               r->line1 += z->img_comp[k].w2;
          }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
+      }
+      if (n >= 3) {
+         stbi_uc *y = coutput[0];
+         if (z->s->img_n == 3) {
+            if (is_rgb) {
                for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
+                  out[0] = y[i];
+                  out[1] = coutput[1][i];
+                  out[2] = coutput[2][i];
+                  out[3] = 255;
                   out += n;
                }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            } else {
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else if (z->s->img_n == 4) {
+            if (z->app14_color_transform == 0) { // CMYK
                for (i=0; i < z->s->img_x; ++i) {
                   stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
+                  out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                  out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                  out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                  out[3] = 255;
                   out += n;
                }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            } else if (z->app14_color_transform == 2) { // YCCK
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
                for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(255 - out[0], m);
+                  out[1] = stbi__blinn_8x8(255 - out[1], m);
+                  out[2] = stbi__blinn_8x8(255 - out[2], m);
                   out += n;
                }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+            } else { // YCbCr + alpha?  Ignore the fourth channel for now
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = out[1] = out[2] = y[i];
+               out[3] = 255; // not used if n==3
+               out += n;
+            }
+      } else {
+         if (is_rgb) {
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i)
+                  *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+            else {
+               for (i=0; i < z->s->img_x; ++i, out += 2) {
+                  out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                  out[1] = 255;
+               }
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+               stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+               stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+               out[0] = stbi__compute_y(r, g, b);
+               out[1] = 255;
+               out += n;
             }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+               out[1] = 255;
+               out += n;
+            }
+         } else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+            else
+               for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+         }
+      }
+   }
+   return 1;
+}
+
+// hands the image as it looks after the latest progressive scan to the pass callback. the idct is done
+// on a copy of the coefficients since later scans keep refining them
+static void stbi__jpeg_preview(stbi__jpeg *z, int pass)
+{
+   int n, decode_n, is_rgb, i, j, k;
+   stbi__uint32 full_x = z->s->img_x, full_y = z->s->img_y;
+   int comp_x[4], comp_y[4];
+   stbi_uc *output;
+   STBI_SIMD_ALIGN(short, data[64]);
+
+   for (k=0; k < z->s->img_n; ++k) {
+      int w = (z->img_comp[k].x+7) >> 3;
+      int h = (z->img_comp[k].y+7) >> 3;
+      int bs = 8 >> z->scale_shift;
+      for (j=0; j < h; ++j) {
+         for (i=0; i < w; ++i) {
+            memcpy(data, z->img_comp[k].coeff + 64 * (i + j * z->img_comp[k].coeff_w), sizeof(data));
+            stbi__jpeg_dequantize(data, z->dequant[z->img_comp[k].tq]);
+            z->idct_block_kernel(z->img_comp[k].data+z->img_comp[k].w2*j*bs+i*bs, z->img_comp[k].w2, data);
          }
       }
+      comp_x[k] = z->img_comp[k].x;
+      comp_y[k] = z->img_comp[k].y;
+   }
+
+   stbi__jpeg_use_reduced_size(z);
+   stbi__jpeg_output_components(z, z->req_comp, &n, &decode_n, &is_rgb);
+   output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+   if (output && decode_n > 0 && stbi__jpeg_convert(z, output, n, decode_n, is_rgb))
+      z->s->pass_callback(z->s->pass_user, output, z->s->img_x, z->s->img_y, z->s->img_n >= 3 ? 3 : 1, pass);
+   STBI_FREE(output);
+
+   // back to the full size for the rest of the scans
+   z->s->img_x = full_x;
+   z->s->img_y = full_y;
+   for (k=0; k < z->s->img_n; ++k) {
+      z->img_comp[k].x = comp_x[k];
+      z->img_comp[k].y = comp_y[k];
+   }
+}
+
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+   int n, decode_n, is_rgb;
+   stbi_uc *output;
+   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+   // validate req_comp
+   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+   z->req_comp = req_comp;
+
+   // load a jpeg image from whichever source, but leave in YCbCr format
+   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+
+   stbi__jpeg_use_reduced_size(z);
+   stbi__jpeg_output_components(z, req_comp, &n, &decode_n, &is_rgb);
+
+   // nothing to do if no components requested; check this now to avoid
+   // accessing uninitialized coutput[0] later
+   if (decode_n <= 0) { stbi__cleanup_jpeg(z); return NULL; }
+
+   output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+   if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+
+   if (!stbi__jpeg_convert(z, output, n, decode_n, is_rgb)) {
+      STBI_FREE(output);
       stbi__cleanup_jpeg(z);
-      *out_x = z->s->img_x;
-      *out_y = z->s->img_y;
-      if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
-      return output;
+      return NULL;
    }
+   stbi__cleanup_jpeg(z);
+   *out_x = z->s->img_x;
+   *out_y = z->s->img_y;
+   if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+   return output;
 }
 
 static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
@@ -4019,6 +4424,17 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
    STBI_FREE(j);
    return result;
 }
+
+static int stbi__jpeg_is_progressive(stbi__context *s)
+{
+   int result;
+   stbi__jpeg* j = (stbi__jpeg*) (stbi__malloc(sizeof(stbi__jpeg)));
+   if (!j) return stbi__err("outofmem", "Out of memory");
+   j->s = s;
+   result = stbi__jpeg_info_raw(j, NULL, NULL, NULL) && j->progressive;
+   STBI_FREE(j);
+   return result;
+}
 #endif
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
@@ -4026,20 +4442,32 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 //      - all input must be provided in an upfront buffer
 //      - all output is written to a single output buffer (can malloc/realloc)
 //    performance
-//      - fast huffman
+//      - fast huffman, with pairs of literals decoded in one lookup
+//      - 64-bit bit buffer refilled a whole word at a time
+//      - matches copied 8 bytes at a time
 
 #ifndef STBI_NO_ZLIB
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
+#define STBI__ZFAST_BITS  10 // accelerate all cases in default tables, and most pairs of literals
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 #define STBI__ZNSYMS 288 // number of symbols in literal/length alphabet
 
+// fast table entries: symbol in the low 9 bits, its code length in the next 4.
+// literal/length tables also pack in a second literal when both codes fit in
+// the fast bits: the literal in bits 16-23 and the length of both codes in 24-28
+#define STBI__ZFAST_PAIR_SHIFT 24
+
+// the bit buffer gets refilled with a single unaligned load when the input bytes land in the right order for it
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64)
+#define STBI__ZWIDE_REFILL
+#endif
+
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
 typedef struct
 {
-   stbi__uint16 fast[1 << STBI__ZFAST_BITS];
+   stbi__uint32 fast[1 << STBI__ZFAST_BITS];
    stbi__uint16 firstcode[16];
    int maxcode[17];
    stbi__uint16 firstsymbol[16];
@@ -4095,7 +4523,7 @@ static int stbi__zbuild_huffman(stbi__zhuffman *z, const stbi_uc *sizelist, int
       int s = sizelist[i];
       if (s) {
          int c = next_code[s] - z->firstcode[s] + z->firstsymbol[s];
-         stbi__uint16 fastv = (stbi__uint16) ((s << 9) | i);
+         stbi__uint32 fastv = (stbi__uint32) ((s << 9) | i);
          z->size [c] = (stbi_uc     ) s;
          z->value[c] = (stbi__uint16) i;
          if (s <= STBI__ZFAST_BITS) {
@@ -4111,6 +4539,22 @@ static int stbi__zbuild_huffman(stbi__zhuffman *z, const stbi_uc *sizelist, int
    return 1;
 }
 
+// a literal whose code leaves enough fast bits over for the next one to be decoded as well gets both
+// packed into its entry. the second lookup only sees the bits that are left, so the second code has to fit in those
+static void stbi__zbuild_literal_pairs(stbi__zhuffman *z)
+{
+   int i;
+   for (i=0; i < (1 << STBI__ZFAST_BITS); ++i) {
+      stbi__uint32 first = z->fast[i], second;
+      int s1 = (first >> 9) & 15, s2;
+      if (first == 0 || (first & 511) >= 256 || s1 >= STBI__ZFAST_BITS) continue;
+      second = z->fast[i >> s1];
+      s2 = (second >> 9) & 15;
+      if (second == 0 || (second & 511) >= 256 || s1 + s2 > STBI__ZFAST_BITS) continue;
+      z->fast[i] = first | ((second & 255) << 16) | ((stbi__uint32) (s1 + s2) << STBI__ZFAST_PAIR_SHIFT);
+   }
+}
+
 // zlib-from-memory implementation for PNG reading
 //    because PNG allows splitting the zlib stream arbitrarily,
 //    and it's annoying structurally to have PNG call ZLIB call PNG,
@@ -4121,13 +4565,21 @@ typedef struct
 {
    stbi_uc *zbuffer, *zbuffer_end;
    int num_bits;
-   stbi__uint32 code_buffer;
+   // zero bytes made up past the end of the input, so stored blocks know how many real bytes are still buffered
+   int num_padding;
+   stbi__uint64 code_buffer;
 
    char *zout;
    char *zout_start;
    char *zout_end;
    int   z_expandable;
 
+   // streaming output: when set, the output buffer is a fixed window that
+   // gets handed to zflush and slid down instead of being grown
+   int  (*zflush)(void *user, const stbi_uc *data, int len);
+   void *zflush_user;
+   char *zflushed;
+
    stbi__zhuffman z_length, z_distance;
 } stbi__zbuf;
 
@@ -4143,14 +4595,27 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
 
 static void stbi__fill_bits(stbi__zbuf *z)
 {
+#ifdef STBI__ZWIDE_REFILL
+   // tops the buffer up to at least 56 bits with whole bytes
+   if (z->zbuffer_end - z->zbuffer >= 8 && z->num_bits >= 0) {
+      int bytes = (63 - z->num_bits) >> 3;
+      stbi__uint64 v;
+      memcpy(&v, z->zbuffer, 8);
+      z->code_buffer |= (v & (((stbi__uint64) 1 << (bytes * 8)) - 1)) << z->num_bits;
+      z->zbuffer  += bytes;
+      z->num_bits += bytes * 8;
+      return;
+   }
+#endif
    do {
-      if (z->code_buffer >= (1U << z->num_bits)) {
+      if (z->code_buffer >= ((stbi__uint64) 1 << z->num_bits)) {
         z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
         return;
       }
-      z->code_buffer |= (unsigned int) stbi__zget8(z) << z->num_bits;
+      if (stbi__zeof(z)) ++z->num_padding;
+      z->code_buffer |= (stbi__uint64) stbi__zget8(z) << z->num_bits;
       z->num_bits += 8;
-   } while (z->num_bits <= 24);
+   } while (z->num_bits <= 56);
 }
 
 stbi_inline static unsigned int stbi__zreceive(stbi__zbuf *z, int n)
@@ -4168,7 +4633,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
    int b,s,k;
    // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = stbi__bit_reverse(a->code_buffer, 16);
+   k = stbi__bit_reverse((int) (a->code_buffer & 0xffff), 16);
    for (s=STBI__ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -4193,7 +4658,7 @@ stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
    }
    b = z->fast[a->code_buffer & STBI__ZFAST_MASK];
    if (b) {
-      s = b >> 9;
+      s = (b >> 9) & 15;
       a->code_buffer >>= s;
       a->num_bits -= s;
       return b & 511;
@@ -4201,11 +4666,33 @@ stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
    return stbi__zhuffman_decode_slowpath(a, z);
 }
 
+// deflate can refer back at most 32k, so that's all that has to be kept around when streaming
+#define STBI__ZWINDOW        32768
+// leaves room for a full stored block (64k) after sliding the window down
+#define STBI__ZSTREAM_BUFFER (STBI__ZWINDOW + 131072)
+
+static int stbi__zflush_window(stbi__zbuf *z)
+{
+   int keep = (int) (z->zout - z->zout_start);
+   if (z->zout > z->zflushed)
+      if (!z->zflush(z->zflush_user, (stbi_uc *) z->zflushed, (int) (z->zout - z->zflushed))) return 0;
+   if (keep > STBI__ZWINDOW) keep = STBI__ZWINDOW;
+   memmove(z->zout_start, z->zout - keep, keep);
+   z->zout     = z->zout_start + keep;
+   z->zflushed = z->zout;
+   return 1;
+}
+
 static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room for n bytes
 {
    char *q;
    unsigned int cur, limit, old_limit;
    z->zout = zout;
+   if (z->zflush) {
+      if (!stbi__zflush_window(z)) return 0;
+      if (z->zout + n > z->zout_end) return stbi__err("output buffer limit","Corrupt PNG");
+      return 1;
+   }
    if (!z->z_expandable) return stbi__err("output buffer limit","Corrupt PNG");
    cur   = (unsigned int) (z->zout - z->zout_start);
    limit = old_limit = (unsigned) (z->zout_end - z->zout_start);
@@ -4241,7 +4728,38 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
    char *zout = a->zout;
    for(;;) {
-      int z = stbi__zhuffman_decode(a, &a->z_length);
+      stbi__uint32 e;
+      int z;
+      // refills give at least 56 bits, enough for several literals before the next one.
+      // lengths and distances top the buffer up again themselves if they need to
+      if (a->num_bits < 16) {
+         if (!stbi__zeof(a))
+            stbi__fill_bits(a);
+         else if (a->num_bits < 16)
+            return stbi__err("bad huffman code","Corrupt PNG"); // unexpected end of data
+      }
+      e = a->z_length.fast[a->code_buffer & STBI__ZFAST_MASK];
+      if (e >> STBI__ZFAST_PAIR_SHIFT) {
+         int s = e >> STBI__ZFAST_PAIR_SHIFT;
+         if (zout + 2 > a->zout_end) {
+            if (!stbi__zexpand(a, zout, 2)) return 0;
+            zout = a->zout;
+         }
+         a->code_buffer >>= s;
+         a->num_bits -= s;
+         zout[0] = (char) (e & 255);
+         zout[1] = (char) ((e >> 16) & 255);
+         zout += 2;
+         continue;
+      }
+      if (e) {
+         int s = (e >> 9) & 15;
+         a->code_buffer >>= s;
+         a->num_bits -= s;
+         z = e & 511;
+      } else {
+         z = stbi__zhuffman_decode_slowpath(a, &a->z_length);
+      }
       if (z < 256) {
          if (z < 0) return stbi__err("bad huffman code","Corrupt PNG"); // error in huffman codes
          if (zout >= a->zout_end) {
@@ -4270,8 +4788,18 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          }
          p = (stbi_uc *) (zout - dist);
          if (dist == 1) { // run of one byte; common in images.
-            stbi_uc v = *p;
-            if (len) { do *zout++ = v; while (--len); }
+            memset(zout, *p, len);
+            zout += len;
+         } else if (dist >= 8 && zout + len + 8 <= a->zout_end) {
+            // each 8 byte chunk only reads bytes that are already written, overshooting the end is fine
+            // since there's room and the next symbol writes over it
+            char *end = zout + len;
+            do {
+               memcpy(zout, p, 8);
+               zout += 8;
+               p += 8;
+            } while (zout < end);
+            zout = end;
          } else {
             if (len) { do *zout++ = *p++; while (--len); }
          }
@@ -4332,20 +4860,19 @@ static int stbi__compute_huffman_codes(stbi__zbuf *a)
 static int stbi__parse_uncompressed_block(stbi__zbuf *a)
 {
    stbi_uc header[4];
-   int len,nlen,k;
+   int len,nlen,k,buffered;
    if (a->num_bits & 7)
       stbi__zreceive(a, a->num_bits & 7); // discard
-   // drain the bit-packed data into header
-   k = 0;
-   while (a->num_bits > 0) {
-      header[k++] = (stbi_uc) (a->code_buffer & 255); // suppress MSVC run-time check
-      a->code_buffer >>= 8;
-      a->num_bits -= 8;
-   }
    if (a->num_bits < 0) return stbi__err("zlib corrupt","Corrupt PNG");
-   // now fill header the normal way
-   while (k < 4)
-      header[k++] = stbi__zget8(a);
+   // the whole bytes left in the bit buffer came straight from the input, so just step back over them
+   buffered = (a->num_bits >> 3) - a->num_padding;
+   if (buffered < 0) return stbi__err("zlib corrupt","Corrupt PNG");
+   a->zbuffer -= buffered;
+   a->code_buffer = 0;
+   a->num_bits = 0;
+   a->num_padding = 0;
+   for (k=0; k < 4; ++k)
+      header[k] = stbi__zget8(a);
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
    if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt","Corrupt PNG");
@@ -4407,6 +4934,7 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
    if (parse_header)
       if (!stbi__parse_zlib_header(a)) return 0;
    a->num_bits = 0;
+   a->num_padding = 0;
    a->code_buffer = 0;
    do {
       final = stbi__zreceive(a,1);
@@ -4423,6 +4951,7 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
          } else {
             if (!stbi__compute_huffman_codes(a)) return 0;
          }
+         stbi__zbuild_literal_pairs(&a->z_length);
          if (!stbi__parse_huffman_block(a)) return 0;
       }
    } while (!final);
@@ -4435,10 +4964,33 @@ static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   a->zflush     = NULL;
 
    return stbi__parse_zlib(a, parse_header);
 }
 
+// decode a zlib stream through a fixed-size window, handing output to 'flush' as it's produced
+static int stbi__do_zlib_stream(stbi__zbuf *a, const stbi_uc *buffer, int len, int parse_header, int (*flush)(void *user, const stbi_uc *data, int len), void *user)
+{
+   int result;
+   char *window = (char *) stbi__malloc(STBI__ZSTREAM_BUFFER);
+   if (window == NULL) return stbi__err("outofmem", "Out of memory");
+   a->zbuffer     = (stbi_uc *) buffer;
+   a->zbuffer_end = (stbi_uc *) buffer + len;
+   a->zout_start  = window;
+   a->zout        = window;
+   a->zout_end    = window + STBI__ZSTREAM_BUFFER;
+   a->z_expandable = 0;
+   a->zflush      = flush;
+   a->zflush_user = user;
+   a->zflushed    = window;
+   result = stbi__parse_zlib(a, parse_header);
+   if (result && a->zout > a->zflushed)
+      result = flush(user, (stbi_uc *) a->zflushed, (int) (a->zout - a->zflushed));
+   STBI_FREE(window);
+   return result;
+}
+
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen)
 {
    stbi__zbuf a;
@@ -4549,11 +5101,15 @@ static int stbi__check_png_header(stbi__context *s)
    return 1;
 }
 
+struct stbi__png_rows;
+
 typedef struct
 {
    stbi__context *s;
    stbi_uc *idata, *expanded, *out;
    int depth;
+   int interlace;
+   struct stbi__png_rows *rows; // non-NULL when streaming rows instead of building a full image
 } stbi__png;
 
 
@@ -4588,6 +5144,175 @@ static int stbi__paeth(int a, int b, int c)
    return c;
 }
 
+// 8-bit rgb and rgba rows get unfiltered a whole pixel at a time, with all its channels in one register.
+// avg and paeth can't go any wider than that since every pixel depends on the one to its left
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+#define STBI__PNG_SIMD
+
+// rgb pixels are put together a byte at a time so the last one never reads or writes past the end of the row
+stbi_inline static stbi__uint32 stbi__png_px_bytes(const stbi_uc *p, int n)
+{
+   stbi__uint32 v;
+   if (n == 4) {
+      memcpy(&v, p, 4);
+      return v;
+   }
+   return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+stbi_inline static void stbi__png_px_put(stbi_uc *p, stbi__uint32 v, int img_n, int out_n)
+{
+   if (out_n == 4) {
+      if (img_n == 3) v |= 0xff000000u;
+      memcpy(p, &v, 4);
+   } else {
+      p[0] = (stbi_uc) v;
+      p[1] = (stbi_uc) (v >> 8);
+      p[2] = (stbi_uc) (v >> 16);
+   }
+}
+
+#ifdef STBI_SSE2
+typedef __m128i stbi__png_px; // the pixel is in the low 4 bytes
+
+#define stbi__png_px_load(p,n)                _mm_cvtsi32_si128((int) stbi__png_px_bytes(p, n))
+#define stbi__png_px_store(p,x,img_n,out_n)   stbi__png_px_put(p, (stbi__uint32) _mm_cvtsi128_si32(x), img_n, out_n)
+
+#define stbi__png_px_zero()   _mm_setzero_si128()
+#define stbi__png_px_add(x,y) _mm_add_epi8(x, y)
+
+// _mm_avg_epu8 rounds up, png wants it rounded down
+stbi_inline static stbi__png_px stbi__png_px_avg(stbi__png_px a, stbi__png_px b)
+{
+   return _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+stbi_inline static __m128i stbi__png_abs16(__m128i x)
+{
+   return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+stbi_inline static __m128i stbi__png_select(__m128i mask, __m128i a, __m128i b)
+{
+   return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+stbi_inline static stbi__png_px stbi__png_px_paeth(stbi__png_px a8, stbi__png_px b8, stbi__png_px c8)
+{
+   __m128i zero = _mm_setzero_si128();
+   __m128i a = _mm_unpacklo_epi8(a8, zero);
+   __m128i b = _mm_unpacklo_epi8(b8, zero);
+   __m128i c = _mm_unpacklo_epi8(c8, zero);
+   // p = a+b-c, so |p-a| = |b-c|, |p-b| = |a-c| and |p-c| = |(b-c) + (a-c)|
+   __m128i pa = _mm_sub_epi16(b, c);
+   __m128i pb = _mm_sub_epi16(a, c);
+   __m128i pc = stbi__png_abs16(_mm_add_epi16(pa, pb));
+   __m128i smallest, pred;
+   pa = stbi__png_abs16(pa);
+   pb = stbi__png_abs16(pb);
+   smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+   // ties go to a, then b
+   pred = stbi__png_select(_mm_cmpeq_epi16(smallest, pa), a,
+          stbi__png_select(_mm_cmpeq_epi16(smallest, pb), b, c));
+   return _mm_packus_epi16(pred, pred);
+}
+#else
+typedef uint8x8_t stbi__png_px; // the pixel is in the low 4 lanes
+
+#define stbi__png_px_load(p,n)                vreinterpret_u8_u32(vdup_n_u32(stbi__png_px_bytes(p, n)))
+#define stbi__png_px_store(p,x,img_n,out_n)   stbi__png_px_put(p, vget_lane_u32(vreinterpret_u32_u8(x), 0), img_n, out_n)
+
+#define stbi__png_px_zero()   vdup_n_u8(0)
+#define stbi__png_px_add(x,y) vadd_u8(x, y)
+#define stbi__png_px_avg(x,y) vhadd_u8(x, y)
+
+stbi_inline static stbi__png_px stbi__png_px_paeth(stbi__png_px a, stbi__png_px b, stbi__png_px c)
+{
+   uint16x8_t pa = vabdl_u8(b, c);
+   uint16x8_t pb = vabdl_u8(a, c);
+   uint16x8_t pc = vabdq_u16(vaddl_u8(a, b), vaddl_u8(c, c));
+   // ties go to a, then b
+   uint8x8_t use_a = vmovn_u16(vandq_u16(vcleq_u16(pa, pb), vcleq_u16(pa, pc)));
+   uint8x8_t use_b = vmovn_u16(vcleq_u16(pb, pc));
+   return vbsl_u8(use_a, a, vbsl_u8(use_b, b, c));
+}
+#endif
+
+// it's only fast with img_n and out_n as constants, so every caller needs its own copy
+#ifdef __GNUC__
+#define STBI__PNG_FORCEINLINE __inline__ __attribute__((always_inline))
+#else
+#define STBI__PNG_FORCEINLINE stbi_inline
+#endif
+
+// out_n can be one more than img_n to widen rgb to rgba on the way, the extra byte gets 255.
+// out and in can be the same row when out_n == img_n
+static STBI__PNG_FORCEINLINE void stbi__png_unfilter_pixels(stbi_uc *out, const stbi_uc *in, const stbi_uc *prior, int filter, stbi__uint32 w, int img_n, int out_n)
+{
+   stbi__uint32 i;
+   stbi__png_px a = stbi__png_px_zero(), b, c = stbi__png_px_zero();
+   if (img_n == out_n && (filter == STBI__F_none || filter == STBI__F_up)) {
+      // these don't depend on the pixel to the left, so plain byte loops vectorize fine
+      if (filter == STBI__F_up)
+         for (i=0; i < w*img_n; ++i) out[i] = STBI__BYTECAST(in[i] + prior[i]);
+      else if (out != in)
+         memcpy(out, in, w*img_n);
+      return;
+   }
+   switch (filter) {
+      case STBI__F_none:
+         for (i=0; i < w; ++i)
+            stbi__png_px_store(out + i*out_n, stbi__png_px_load(in + i*img_n, img_n), img_n, out_n);
+         break;
+      case STBI__F_sub:
+      case STBI__F_paeth_first:
+         for (i=0; i < w; ++i) {
+            a = stbi__png_px_add(stbi__png_px_load(in + i*img_n, img_n), a);
+            stbi__png_px_store(out + i*out_n, a, img_n, out_n);
+         }
+         break;
+      case STBI__F_up:
+         for (i=0; i < w; ++i) {
+            b = stbi__png_px_load(prior + i*out_n, img_n);
+            stbi__png_px_store(out + i*out_n, stbi__png_px_add(stbi__png_px_load(in + i*img_n, img_n), b), img_n, out_n);
+         }
+         break;
+      case STBI__F_avg:
+         for (i=0; i < w; ++i) {
+            b = stbi__png_px_load(prior + i*out_n, img_n);
+            a = stbi__png_px_add(stbi__png_px_load(in + i*img_n, img_n), stbi__png_px_avg(a, b));
+            stbi__png_px_store(out + i*out_n, a, img_n, out_n);
+         }
+         break;
+      case STBI__F_avg_first:
+         for (i=0; i < w; ++i) {
+            a = stbi__png_px_add(stbi__png_px_load(in + i*img_n, img_n), stbi__png_px_avg(a, stbi__png_px_zero()));
+            stbi__png_px_store(out + i*out_n, a, img_n, out_n);
+         }
+         break;
+      case STBI__F_paeth:
+         for (i=0; i < w; ++i) {
+            b = stbi__png_px_load(prior + i*out_n, img_n);
+            a = stbi__png_px_add(stbi__png_px_load(in + i*img_n, img_n), stbi__png_px_paeth(a, b, c));
+            c = b;
+            stbi__png_px_store(out + i*out_n, a, img_n, out_n);
+         }
+         break;
+   }
+}
+
+// w pixels of img_n (3 or 4) bytes from in to out_n (img_n or img_n+1) bytes at out, prior is the last output row
+static void stbi__png_unfilter_simd(stbi_uc *out, const stbi_uc *in, const stbi_uc *prior, int filter, stbi__uint32 w, int img_n, int out_n)
+{
+   if (img_n == 4)
+      stbi__png_unfilter_pixels(out, in, prior, filter, w, 4, 4);
+   else if (out_n == 4)
+      stbi__png_unfilter_pixels(out, in, prior, filter, w, 3, 4);
+   else
+      stbi__png_unfilter_pixels(out, in, prior, filter, w, 3, 3);
+}
+#endif // STBI_SSE2 || STBI_NEON
+
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // create the png data from post-deflated data
@@ -4636,6 +5361,14 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
 
+#ifdef STBI__PNG_SIMD
+      if (depth == 8 && img_n >= 3) {
+         stbi__png_unfilter_simd(cur, raw, prior, filter, x, img_n, out_n);
+         raw += x*img_n;
+         continue;
+      }
+#endif
+
       // handle first byte explicitly
       for (k=0; k < filter_bytes; ++k) {
          switch (filter) {
@@ -5020,6 +5753,237 @@ static void stbi__de_iphone(stbi__png *z)
 
 #define STBI__PNG_TYPE(a,b,c,d)  (((unsigned) (a) << 24) + ((unsigned) (b) << 16) + ((unsigned) (c) << 8) + (unsigned) (d))
 
+// undo the filter on one row of 8-bit samples in place; 'prior' is the previous
+// unfiltered row (all zeros for the first row)
+static void stbi__png_unfilter_row(stbi_uc *cur, const stbi_uc *prior, int filter, stbi__uint32 len, int bpp)
+{
+   stbi__uint32 i;
+#ifdef STBI__PNG_SIMD
+   if (bpp >= 3 && filter <= STBI__F_paeth) {
+      stbi__png_unfilter_simd(cur, cur, prior, filter, len / bpp, bpp, bpp);
+      return;
+   }
+#endif
+   switch (filter) {
+      case STBI__F_none:
+         break;
+      case STBI__F_sub:
+         for (i=bpp; i < len; ++i) cur[i] = STBI__BYTECAST(cur[i] + cur[i-bpp]);
+         break;
+      case STBI__F_up:
+         for (i=0; i < len; ++i) cur[i] = STBI__BYTECAST(cur[i] + prior[i]);
+         break;
+      case STBI__F_avg:
+         for (i=0; i < (stbi__uint32) bpp; ++i) cur[i] = STBI__BYTECAST(cur[i] + (prior[i]>>1));
+         for (   ; i < len; ++i) cur[i] = STBI__BYTECAST(cur[i] + ((prior[i] + cur[i-bpp])>>1));
+         break;
+      case STBI__F_paeth:
+         for (i=0; i < (stbi__uint32) bpp; ++i) cur[i] = STBI__BYTECAST(cur[i] + prior[i]);
+         for (   ; i < len; ++i) cur[i] = STBI__BYTECAST(cur[i] + stbi__paeth(cur[i-bpp], prior[i], prior[i-bpp]));
+         break;
+   }
+}
+
+typedef struct stbi__png_rows
+{
+   stbi_row_callback *callback;
+   void *user;
+   int req_comp;
+
+   // filled in from the chunks before IEND
+   stbi_uc palette[1024];
+   int pal_img_n, has_trans;
+   stbi_uc tc[3];
+
+   stbi_uc *cur, *prior, *out;  // cur has the filter byte at the front
+   stbi__uint32 stride, filled, y;
+   int img_n, channels_in_file;
+   stbi__uint32 w, h;
+
+   // interlaced images build up the whole thing in 'image' instead, w and h
+   // are the size of the current adam7 pass
+   stbi_uc *image;
+   stbi__uint32 image_w, image_h;
+   int pass;
+   stbi__context *s;
+} stbi__png_rows;
+
+static const int stbi__adam7_xorig[7] = { 0,4,0,2,0,1,0 };
+static const int stbi__adam7_yorig[7] = { 0,0,4,0,2,0,1 };
+static const int stbi__adam7_xspc[7]  = { 8,8,4,4,2,2,1 };
+static const int stbi__adam7_yspc[7]  = { 8,8,8,4,4,2,2 };
+// how much of the image each pixel stands in for until later passes fill in the rest
+static const int stbi__adam7_blockw[7] = { 8,4,4,2,2,1,1 };
+static const int stbi__adam7_blockh[7] = { 8,8,4,4,2,2,1 };
+
+// moves on to the next pass that has any pixels in it, h ends up 0 once they're all done
+static void stbi__png_rows_next_pass(stbi__png_rows *r)
+{
+   r->w = r->h = 0;
+   while (++r->pass < 7) {
+      int p = r->pass;
+      r->w = (r->image_w - stbi__adam7_xorig[p] + stbi__adam7_xspc[p]-1) / stbi__adam7_xspc[p];
+      r->h = (r->image_h - stbi__adam7_yorig[p] + stbi__adam7_yspc[p]-1) / stbi__adam7_yspc[p];
+      if (r->w && r->h) break;
+      r->w = r->h = 0;
+   }
+   r->stride = r->w * r->img_n;
+   r->filled = 0;
+   r->y = 0;
+   memset(r->prior, 0, r->stride + 1);
+}
+
+// spreads a converted pass row over the blocks its pixels stand in for
+static void stbi__png_rows_place(stbi__png_rows *r)
+{
+   int p = r->pass, n = r->req_comp;
+   stbi__uint32 i, dx, dy;
+   stbi__uint32 out_y = r->y * stbi__adam7_yspc[p] + stbi__adam7_yorig[p];
+   stbi__uint32 bh = stbi__adam7_blockh[p];
+   if (bh > r->image_h - out_y) bh = r->image_h - out_y;
+   for (i=0; i < r->w; ++i) {
+      stbi__uint32 out_x = i * stbi__adam7_xspc[p] + stbi__adam7_xorig[p];
+      stbi__uint32 bw = stbi__adam7_blockw[p];
+      if (bw > r->image_w - out_x) bw = r->image_w - out_x;
+      for (dy=0; dy < bh; ++dy) {
+         stbi_uc *dest = r->image + ((out_y + dy) * r->image_w + out_x) * n;
+         for (dx=0; dx < bw; ++dx)
+            memcpy(dest + dx*n, r->out + i*n, n);
+      }
+   }
+}
+
+static void stbi__png_rows_convert(stbi__png_rows *r, const stbi_uc *src)
+{
+   stbi__uint32 i;
+   stbi_uc *dest = r->out;
+   for (i=0; i < r->w; ++i) {
+      stbi_uc px[4];
+      switch (r->img_n) {
+         case 1:
+            if (r->pal_img_n) {
+               const stbi_uc *p = r->palette + src[i]*4;
+               px[0] = p[0]; px[1] = p[1]; px[2] = p[2]; px[3] = p[3];
+            } else {
+               px[0] = px[1] = px[2] = src[i];
+               px[3] = (r->has_trans && src[i] == r->tc[0]) ? 0 : 255;
+            }
+            break;
+         case 2:
+            px[0] = px[1] = px[2] = src[i*2];
+            px[3] = src[i*2+1];
+            break;
+         case 3:
+            px[0] = src[i*3]; px[1] = src[i*3+1]; px[2] = src[i*3+2];
+            px[3] = (r->has_trans && px[0] == r->tc[0] && px[1] == r->tc[1] && px[2] == r->tc[2]) ? 0 : 255;
+            break;
+         default:
+            px[0] = src[i*4]; px[1] = src[i*4+1]; px[2] = src[i*4+2]; px[3] = src[i*4+3];
+            break;
+      }
+      switch (r->req_comp) {
+         case 1: dest[0] = stbi__compute_y(px[0],px[1],px[2]); break;
+         case 2: dest[0] = stbi__compute_y(px[0],px[1],px[2]); dest[1] = px[3]; break;
+         case 3: dest[0] = px[0]; dest[1] = px[1]; dest[2] = px[2]; break;
+         default: dest[0] = px[0]; dest[1] = px[1]; dest[2] = px[2]; dest[3] = px[3]; break;
+      }
+      dest += r->req_comp;
+   }
+}
+
+// zlib output arrives in arbitrary pieces, so gather it up into rows
+static int stbi__png_rows_consume(void *user, const stbi_uc *data, int len)
+{
+   stbi__png_rows *r = (stbi__png_rows *) user;
+   while (len > 0 && r->y < r->h) {
+      stbi__uint32 n = r->stride + 1 - r->filled;
+      if (n > (stbi__uint32) len) n = len;
+      memcpy(r->cur + r->filled, data, n);
+      r->filled += n;
+      data += n;
+      len -= n;
+      if (r->filled == r->stride + 1) {
+         stbi_uc *t;
+         if (r->cur[0] > 4) return stbi__err("invalid filter","Corrupt PNG");
+         stbi__png_unfilter_row(r->cur + 1, r->prior + 1, r->cur[0], r->stride, r->img_n);
+         stbi__png_rows_convert(r, r->cur + 1);
+         if (r->image)
+            stbi__png_rows_place(r);
+         else
+            r->callback(r->user, r->out, r->y, r->w, r->h, r->channels_in_file);
+         t = r->prior; r->prior = r->cur; r->cur = t;
+         r->filled = 0;
+         ++r->y;
+         if (r->image && r->y == r->h) {
+            int finished = r->pass + 1;
+            stbi__png_rows_next_pass(r);
+            // the last pass is the final image, that just gets returned
+            if (r->h)
+               r->s->pass_callback(r->s->pass_user, r->image, r->image_w, r->image_h, r->channels_in_file, finished);
+         }
+      }
+   }
+   return 1;
+}
+
+static int stbi__png_stream_rows(stbi__png *z, stbi__uint32 idata_len, int is_iphone)
+{
+   stbi__png_rows *r = z->rows;
+   stbi__context *s = z->s;
+   stbi__zbuf a;
+   stbi_uc *buffers;
+   int result;
+
+   r->w = s->img_x;
+   r->h = s->img_y;
+   r->img_n = s->img_n;
+   r->stride = s->img_x * s->img_n;
+   r->channels_in_file = r->pal_img_n ? r->pal_img_n : s->img_n + r->has_trans;
+   r->filled = 0;
+   r->y = 0;
+
+   buffers = (stbi_uc *) stbi__malloc_mad2(r->stride + 1, 2, s->img_x * r->req_comp);
+   if (buffers == NULL) return stbi__err("outofmem", "Out of memory");
+   r->cur   = buffers;
+   r->prior = buffers + r->stride + 1;
+   r->out   = buffers + (r->stride + 1) * 2;
+   memset(r->prior, 0, r->stride + 1);
+
+   if (r->image) {
+      r->image_w = s->img_x;
+      r->image_h = s->img_y;
+      r->pass = -1;
+      stbi__png_rows_next_pass(r);
+   }
+
+   result = stbi__do_zlib_stream(&a, z->idata, idata_len, !is_iphone, stbi__png_rows_consume, r);
+   if (result && r->y < r->h) result = stbi__err("not enough pixels","Corrupt PNG");
+   STBI_FREE(buffers);
+   return result;
+}
+
+// 8-bit interlaced images with a pass callback get decoded through the row streaming code so each
+// adam7 pass can be shown as soon as its part of the zlib stream has been inflated
+static int stbi__png_load_passes(stbi__png *z, stbi__uint32 idata_len, int req_comp)
+{
+   stbi__context *s = z->s;
+   int result;
+   z->rows->req_comp = req_comp;
+   z->rows->s = s;
+   z->rows->image = (stbi_uc *) stbi__malloc_mad3(s->img_x, s->img_y, req_comp, 0);
+   if (z->rows->image == NULL) return stbi__err("outofmem", "Out of memory");
+   result = stbi__png_stream_rows(z, idata_len, 0);
+   if (result && z->rows->h) result = stbi__err("not enough pixels","Corrupt PNG");
+   if (!result) {
+      STBI_FREE(z->rows->image);
+      return 0;
+   }
+   z->out = z->rows->image;
+   s->img_n = z->rows->channels_in_file;
+   s->img_out_n = req_comp;
+   return 1;
+}
+
 static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
 {
    stbi_uc palette[1024], pal_img_n=0;
@@ -5060,7 +6024,9 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             comp  = stbi__get8(s);  if (comp) return stbi__err("bad comp method","Corrupt PNG");
             filter= stbi__get8(s);  if (filter) return stbi__err("bad filter method","Corrupt PNG");
             interlace = stbi__get8(s); if (interlace>1) return stbi__err("bad interlace method","Corrupt PNG");
+            z->interlace = interlace;
             if (!s->img_x || !s->img_y) return stbi__err("0-pixel image","Corrupt PNG");
+            if (z->rows && (z->depth != 8 || interlace || is_iphone)) return stbi__err("can't stream","PNG not supported: can't stream this PNG");
             if (!pal_img_n) {
                s->img_n = (color & 2 ? 3 : 1) + (color & 4 ? 1 : 0);
                if ((1 << 30) / s->img_x / s->img_n < s->img_y) return stbi__err("too large", "Image too large to decode");
@@ -5137,6 +6103,25 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             if (first) return stbi__err("first not IHDR", "Corrupt PNG");
             if (scan != STBI__SCAN_load) return 1;
             if (z->idata == NULL) return stbi__err("no IDAT","Corrupt PNG");
+            if (z->rows) {
+               z->rows->pal_img_n = pal_img_n;
+               z->rows->has_trans = has_trans;
+               memcpy(z->rows->palette, palette, sizeof(palette));
+               memcpy(z->rows->tc, tc, sizeof(tc));
+               return stbi__png_stream_rows(z, ioff, is_iphone);
+            }
+            if (s->pass_callback && interlace && z->depth == 8 && !is_iphone && req_comp) {
+               stbi__png_rows passes;
+               int result;
+               passes.pal_img_n = pal_img_n;
+               passes.has_trans = has_trans;
+               memcpy(passes.palette, palette, sizeof(palette));
+               memcpy(passes.tc, tc, sizeof(tc));
+               z->rows = &passes;
+               result = stbi__png_load_passes(z, ioff, req_comp);
+               z->rows = NULL;
+               return result;
+            }
             // initial guess for decoded data size to avoid unnecessary reallocs
             bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
             raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
@@ -5232,6 +6217,7 @@ static void *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req
 {
    stbi__png p;
    p.s = s;
+   p.rows = NULL;
    return stbi__do_png(&p, x,y,comp,req_comp, ri);
 }
 
@@ -5259,13 +6245,25 @@ static int stbi__png_info(stbi__context *s, int *x, int *y, int *comp)
 {
    stbi__png p;
    p.s = s;
+   p.rows = NULL;
    return stbi__png_info_raw(&p, x, y, comp);
 }
 
+static int stbi__png_is_interlaced(stbi__context *s)
+{
+   stbi__png p;
+   p.s = s;
+   p.rows = NULL;
+   if (!stbi__png_info_raw(&p, NULL, NULL, NULL))
+      return 0;
+   return p.interlace;
+}
+
 static int stbi__png_is16(stbi__context *s)
 {
    stbi__png p;
    p.s = s;
+   p.rows = NULL;
    if (!stbi__png_info_raw(&p, NULL, NULL, NULL))
 	   return 0;
    if (p.depth != 16) {
@@ -5274,6 +6272,48 @@ static int stbi__png_is16(stbi__context *s)
    }
    return 1;
 }
+
+static int stbi__load_rows_main(stbi__context *s, int req_comp, stbi_row_callback *callback, void *user)
+{
+   stbi__png p;
+   stbi__png_rows *rows;
+   int result;
+   if (req_comp < 1 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+   if (!stbi__png_test(s)) return stbi__err("can't stream","Image not supported: only PNGs can be streamed");
+   rows = (stbi__png_rows *) stbi__malloc(sizeof(*rows));
+   if (rows == NULL) return stbi__err("outofmem", "Out of memory");
+   rows->callback = callback;
+   rows->user = user;
+   rows->req_comp = req_comp;
+   rows->image = NULL;
+   p.s = s;
+   p.rows = rows;
+   result = stbi__parse_png_file(&p, STBI__SCAN_load, req_comp);
+   STBI_FREE(p.idata);
+   STBI_FREE(rows);
+   return result;
+}
+
+STBIDEF int stbi_load_rows_from_memory(stbi_uc const *buffer, int len, int desired_channels, stbi_row_callback *callback, void *user)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_rows_main(&s, desired_channels, callback, user);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_rows(char const *filename, int desired_channels, stbi_row_callback *callback, void *user)
+{
+   stbi__context s;
+   int result;
+   FILE *f = stbi__fopen(filename, "rb");
+   if (!f) return stbi__err("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   result = stbi__load_rows_main(&s, desired_channels, callback, user);
+   fclose(f);
+   return result;
+}
+#endif
 #endif
 
 // Microsoft/Windows BMP image
@@ -7000,6 +8040,137 @@ static int stbi__gif_info(stbi__context *s, int *x, int *y, int *comp)
 {
    return stbi__gif_info_raw(s,x,y,comp);
 }
+
+static void stbi__gif_skip_subblocks(stbi__context *s)
+{
+   int len;
+   while ((len = stbi__get8(s)) != 0)
+      stbi__skip(s, len);
+}
+
+// walks the blocks without decoding anything; stops early on anything it
+// doesn't recognize, so a corrupt file just reports fewer frames
+static int stbi__gif_frame_count(stbi__context *s, int *interlaced)
+{
+   int frames = 0, flags;
+   stbi__skip(s, 10); // signature, width and height
+   flags = stbi__get8(s);
+   stbi__skip(s, 2);
+   if (flags & 0x80) stbi__skip(s, 3 * (2 << (flags & 7)));
+
+   for (;;) {
+      int tag = stbi__get8(s);
+      if (tag == 0x2C) {
+         stbi__skip(s, 8); // position and size
+         flags = stbi__get8(s);
+         if (frames == 0) *interlaced = (flags & 0x40) != 0;
+         if (flags & 0x80) stbi__skip(s, 3 * (2 << (flags & 7)));
+         stbi__get8(s); // lzw code size
+         stbi__gif_skip_subblocks(s);
+         ++frames;
+      } else if (tag == 0x21) {
+         stbi__get8(s); // extension label
+         stbi__gif_skip_subblocks(s);
+      } else {
+         break;
+      }
+      if (stbi__at_eof(s)) break;
+   }
+   return frames;
+}
+
+struct stbi_gif_frames
+{
+   stbi__context s;
+   stbi__gif g;
+#ifndef STBI_NO_STDIO
+   FILE *f;
+#endif
+   stbi_uc *last, *before_last; // the previous two frames, for dispose mode 3
+   int count;
+   int done;
+};
+
+static stbi_gif_frames *stbi__gif_frames_start(stbi_gif_frames *frames)
+{
+   if (!stbi__gif_test(&frames->s)) {
+      stbi_gif_frames_close(frames);
+      stbi__err("not GIF", "Image was not as a gif type.");
+      return NULL;
+   }
+   return frames;
+}
+
+STBIDEF stbi_gif_frames *stbi_gif_frames_open_memory(stbi_uc const *buffer, int len)
+{
+   stbi_gif_frames *frames = (stbi_gif_frames *) stbi__malloc(sizeof(stbi_gif_frames));
+   if (!frames) return (stbi_gif_frames *) stbi__errpuc("outofmem", "Out of memory");
+   memset(frames, 0, sizeof(*frames));
+   stbi__start_mem(&frames->s, buffer, len);
+   return stbi__gif_frames_start(frames);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_gif_frames *stbi_gif_frames_open(char const *filename)
+{
+   stbi_gif_frames *frames;
+   FILE *f = stbi__fopen(filename, "rb");
+   if (!f) return (stbi_gif_frames *) stbi__errpuc("can't fopen", "Unable to open file");
+   frames = (stbi_gif_frames *) stbi__malloc(sizeof(stbi_gif_frames));
+   if (!frames) {
+      fclose(f);
+      return (stbi_gif_frames *) stbi__errpuc("outofmem", "Out of memory");
+   }
+   memset(frames, 0, sizeof(*frames));
+   frames->f = f;
+   stbi__start_file(&frames->s, f);
+   return stbi__gif_frames_start(frames);
+}
+#endif
+
+STBIDEF stbi_uc *stbi_gif_frames_next(stbi_gif_frames *frames, int *x, int *y, int *delay)
+{
+   stbi_uc *u, *tmp;
+   int comp, size;
+   if (frames->done) return NULL;
+   u = stbi__gif_load_next(&frames->s, &frames->g, &comp, 4, frames->count >= 2 ? frames->before_last : 0);
+   if (u == 0 || u == (stbi_uc *) &frames->s) {
+      frames->done = 1;
+      return NULL;
+   }
+   size = frames->g.w * frames->g.h * 4;
+   if (!frames->last) {
+      frames->last = (stbi_uc *) stbi__malloc(size);
+      frames->before_last = (stbi_uc *) stbi__malloc(size);
+      if (!frames->last || !frames->before_last) {
+         frames->done = 1;
+         return stbi__errpuc("outofmem", "Out of memory");
+      }
+   }
+   tmp = frames->before_last;
+   frames->before_last = frames->last;
+   frames->last = tmp;
+   memcpy(frames->last, u, size);
+   ++frames->count;
+   *x = frames->g.w;
+   *y = frames->g.h;
+   if (delay) *delay = frames->g.delay;
+   return u;
+}
+
+STBIDEF void stbi_gif_frames_close(stbi_gif_frames *frames)
+{
+   if (!frames) return;
+   STBI_FREE(frames->g.out);
+   STBI_FREE(frames->g.history);
+   STBI_FREE(frames->g.background);
+   STBI_FREE(frames->last);
+   STBI_FREE(frames->before_last);
+#ifndef STBI_NO_STDIO
+   if (frames->f) fclose(frames->f);
+#endif
+   STBI_FREE(frames);
+}
 #endif
 
 // *************************************************************************************************
@@ -7668,6 +8839,44 @@ STBIDEF int stbi_is_16_bit_from_callbacks(stbi_io_callbacks const *c, void *user
    return stbi__is_16_main(&s);
 }
 
+STBIDEF int stbi_probe_from_memory(stbi_uc const *buffer, int len, stbi_probe *probe)
+{
+   stbi__context s;
+   memset(probe, 0, sizeof(*probe));
+   probe->frames = 1;
+
+   stbi__start_mem(&s,buffer,len);
+   if (!stbi__info_main(&s, &probe->x, &probe->y, &probe->comp)) return 0;
+   stbi__start_mem(&s,buffer,len);
+   probe->is_16_bit = stbi__is_16_main(&s);
+
+   stbi__start_mem(&s,buffer,len);
+   #ifndef STBI_NO_JPEG
+   if (stbi__jpeg_test(&s)) {
+      probe->is_jpeg = 1;
+      probe->progressive = stbi__jpeg_is_progressive(&s);
+      return 1;
+   }
+   #endif
+
+   #ifndef STBI_NO_PNG
+   if (stbi__png_test(&s)) {
+      probe->is_png = 1;
+      probe->progressive = stbi__png_is_interlaced(&s);
+      return 1;
+   }
+   #endif
+
+   #ifndef STBI_NO_GIF
+   if (stbi__gif_test(&s)) {
+      probe->frames = stbi__gif_frame_count(&s, &probe->progressive);
+      if (probe->frames < 1) probe->frames = 1;
+      return 1;
+   }
+   #endif
+   return 1;
+}
+
 #endif // STB_IMAGE_IMPLEMENTATION
 
 /*